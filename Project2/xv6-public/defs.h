@@ -2,7 +2,10 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct lazyseg;
 struct pipe;
+struct proghdr;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -24,6 +27,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+uint            execseg(pde_t*, struct inode*, struct proghdr*, struct lazyseg*, int*, uint);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,6 +44,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -96,6 +101,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -125,6 +131,11 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void            kmem_cache_init(struct kmem_cache*, char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -160,11 +171,24 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// text.c
+void            textinit(void);
+char*           textget(struct inode*, uint, uint);
+char*           textadd(struct inode*, uint, uint, char*);
+void            textdup(uint);
+void            textput(uint);
+void            textinval(struct inode*);
+int             textcount(struct inode*);
+int             textreclaim(void);
+void            textdump(void);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
+void            timer_add(struct proc*);
+void            timer_del(struct proc*);
 
 // uart.c
 void            uartinit(void);
@@ -181,6 +205,9 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
+int             lazyfault(struct proc*, uint);
+int             lazytouch(struct proc*, uint, uint);
+int             textcow(pde_t*, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
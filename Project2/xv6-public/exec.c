@@ -8,6 +8,34 @@
 #include "elf.h"
 #include "thread.h"
 
+//* Add program segment ph to lseg[] to be paged in on demand, or
+//* load it now if lseg[] is full. Returns the new image size, or 0
+//* on error. Also used by exec2().
+uint
+execseg(pde_t *pgdir, struct inode *ip, struct proghdr *ph,
+        struct lazyseg *lseg, int *nlseg, uint sz)
+{
+  struct lazyseg *ls;
+  uint end;
+
+  end = ph->vaddr + ph->memsz;
+  if(end >= KERNBASE || ph->vaddr < PGROUNDUP(sz))
+    return 0;
+  if(*nlseg < NLAZYSEG){
+    ls = &lseg[(*nlseg)++];
+    ls->va = ph->vaddr;
+    ls->end = end;
+    ls->off = ph->off;
+    ls->filesz = ph->filesz;
+    return end;
+  }
+  if((sz = allocuvm(pgdir, sz, end)) == 0)
+    return 0;
+  if(loaduvm(pgdir, (char*)ph->vaddr, ip, ph->off, ph->filesz) < 0)
+    return 0;
+  return sz;
+}
+
 int
 exec(char *path, char **argv)
 {
@@ -18,6 +46,9 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct inode *lip, *oldlip;
+  struct lazyseg lseg[NLAZYSEG];
+  int nlseg;
   struct proc *curproc = myproc();
   //struct proc *tgt;
 
@@ -43,6 +74,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  lip = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -54,7 +86,10 @@ exec(char *path, char **argv)
     goto bad;
 
   // Load program into memory.
+  //* Segments are only recorded; lazyfault() reads each page on
+  //* first touch.
   sz = 0;
+  nlseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -64,14 +99,16 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if((sz = execseg(pgdir, ip, &ph, lseg, &nlseg, sz)) == 0)
       goto bad;
   }
-  iunlockput(ip);
+  if(nlseg > 0){
+    iunlock(ip);
+    lip = ip;
+  } else
+    iunlockput(ip);
   end_op();
   ip = 0;
   // Allocate two pages at the next page boundary.
@@ -113,12 +150,21 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
+  oldlip = curproc->lip;
   curproc->pgdir = pgdir;
+  curproc->lip = lip;
+  curproc->nlseg = nlseg;
+  memmove(curproc->lseg, lseg, sizeof(lseg));
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  if(oldlip){
+    begin_op();
+    iput(oldlip);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -128,5 +174,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(lip){
+    begin_op();
+    iput(lip);
+    end_op();
+  }
   return -1;
 }
@@ -19,6 +19,9 @@ exec2(char *path, char **argv, int stacksize)
   struct inode *ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct inode *lip, *oldlip;
+  struct lazyseg lseg[NLAZYSEG];
+  int nlseg;
   struct proc *curproc = myproc();
 
   //* Check if current process is thread
@@ -50,6 +53,7 @@ exec2(char *path, char **argv, int stacksize)
   }
   ilock(ip);
   pgdir = 0;
+  lip = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -61,7 +65,10 @@ exec2(char *path, char **argv, int stacksize)
     goto bad;
 
   // Load program into memory.
+  //* Segments are only recorded; lazyfault() reads each page on
+  //* first touch.
   sz = 0;
+  nlseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -71,14 +78,16 @@ exec2(char *path, char **argv, int stacksize)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if((sz = execseg(pgdir, ip, &ph, lseg, &nlseg, sz)) == 0)
       goto bad;
   }
-  iunlockput(ip);
+  if(nlseg > 0){
+    iunlock(ip);
+    lip = ip;
+  } else
+    iunlockput(ip);
   end_op();
   ip = 0;
 
@@ -123,12 +132,21 @@ exec2(char *path, char **argv, int stacksize)
 
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
+  oldlip = curproc->lip;
   curproc->pgdir = pgdir;
+  curproc->lip = lip;
+  curproc->nlseg = nlseg;
+  memmove(curproc->lseg, lseg, sizeof(lseg));
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  if(oldlip){
+    begin_op();
+    iput(oldlip);
+    end_op();
+  }
 
   //cprintf("Allocated: %d Stacksize + 1 Guard Page\n", stacksize);
   return 0;
@@ -140,6 +158,11 @@ exec2(char *path, char **argv, int stacksize)
     iunlockput(ip);
     end_op();
   }
+  if(lip){
+    begin_op();
+    iput(lip);
+    end_op();
+  }
   return -1;
 }
 
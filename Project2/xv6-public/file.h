@@ -14,6 +14,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; //* icache list
+  int ntext;          //* text cache pages, or more; 0: none (tcache.lock)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -20,6 +20,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -162,22 +163,29 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+//* Entries come from a slab cache and sit on the icache.head list while
+//* referenced; the last iput() gives the entry back to the cache. An
+//* entry without references was never reused as-is anyway, so nothing
+//* is lost, and there is no NINODE limit.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;
+  struct kmem_cache cache;
 } icache;
 
+//* Called from main(): userinit() looks up "/" before iinit() runs.
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  kmem_cache_init(&icache.cache, "inode", sizeof(struct inode));
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
@@ -241,31 +249,30 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  //* Add a new entry.
+  if((ip = kmem_cache_alloc(&icache.cache)) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
+  memset(ip, 0, sizeof(*ip));
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = icache.head;
+  icache.head = ip;
   release(&icache.lock);
 
   return ip;
@@ -305,6 +312,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    if(ip->type == T_FILE)
+      ip->ntext = textcount(ip);  //* pages outlive the icache entry
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -331,6 +340,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -347,7 +358,13 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    //* Last reference: off the list and back to the cache.
+    for(pp = &icache.head; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    kmem_cache_free(&icache.cache, ip);
+  }
   release(&icache.lock);
 }
 
@@ -411,6 +428,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  textinval(ip);  //* its blocks may become another file's
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -494,6 +512,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->type == T_FILE)
+    textinval(ip);  //* cached program pages go stale
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -19,10 +19,27 @@ struct run {
   struct run *next;
 };
 
+//* Per-CPU page caches.
+//* Each CPU frees to and allocates from its own list, under its own
+//* lock that other CPUs only take to steal when memory runs low, so
+//* fork/exec/thread creation on different CPUs do not fight over
+//* kmem.lock. A CPU refills KBATCH pages at a time from the global list
+//* when its list is empty, and drains KBATCH pages back once it holds
+//* more than KCACHEMAX.
+#define KBATCH    16
+#define KCACHEMAX (2*KBATCH)
+
+struct kcpu {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+};
+
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct kcpu cpu[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -30,10 +47,16 @@ struct {
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+//* Until kinit2() is done only the global list is used: there is one
+//* CPU and mycpu() does not work yet.
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmemcpu");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -54,6 +77,20 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE  <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+//* This CPU's page cache. The caller may migrate right after; that is
+//* harmless, the cache is locked.
+static struct kcpu*
+mykcpu(void)
+{
+  struct kcpu *c;
+
+  pushcli();
+  c = &kmem.cpu[cpuid()];
+  popcli();
+  return c;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -62,21 +99,64 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *last;
+  struct kcpu *c;
+  int i;
 
   if((uint)v % (PGSIZE) || v < end || V2P(v) >= PHYSTOP) 
     panic("kfree");
 
   // Fill with junk to catch dangling refs.
-  memset(v, 1, (PGSIZE));
+  //* Skipped with KJUNK 0 (param.h), for production kernels.
+  if(KJUNK)
+    memset(v, 1, (PGSIZE));
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  c = mykcpu();
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KCACHEMAX){
+    //* Drain a batch back to the global list.
+    for(last = c->freelist, i = 1; i < KBATCH; i++)
+      last = last->next;
+    acquire(&kmem.lock);
+    r = c->freelist;
+    c->freelist = last->next;
+    last->next = kmem.freelist;
+    kmem.freelist = r;
     release(&kmem.lock);
+    c->n -= KBATCH;
+  }
+  release(&c->lock);
+}
+
+//* Take a page from another CPU's cache; the global list is empty.
+static struct run*
+ksteal(struct kcpu *self)
+{
+  struct kcpu *c;
+  struct run *r;
+
+  for(c = kmem.cpu; c < &kmem.cpu[NCPU]; c++){
+    if(c == self)
+      continue;
+    acquire(&c->lock);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->n--;
+    }
+    release(&c->lock);
+    if(r)
+      return r;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -86,15 +166,35 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *c;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r)
+      kmem.freelist = r->next;
+    return (char*)r;
   }
-  if(kmem.use_lock)
+
+  c = mykcpu();
+  acquire(&c->lock);
+  if(c->n == 0){
+    //* Refill a batch from the global list.
+    acquire(&kmem.lock);
+    while(c->n < KBATCH && (r = kmem.freelist) != 0){
+      kmem.freelist = r->next;
+      r->next = c->freelist;
+      c->freelist = r;
+      c->n++;
+    }
     release(&kmem.lock);
+  }
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->n--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = ksteal(c);
   return (char*)r;
 }
 
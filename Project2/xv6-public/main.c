@@ -30,6 +30,9 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  icacheinit();    // inode cache
+  pipeinit();      // pipe cache
+  textinit();      //* program text cache
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
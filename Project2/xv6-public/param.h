@@ -3,8 +3,6 @@
 #define THREADSPACE 2046 // size of thread space
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -12,4 +10,7 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define KJUNK           1  //* kfree() junk-fills pages; 0 for production
+#define NLAZYSEG        4  //* demand-paged ELF segments per process
+#define NTPAGE        512  //* program pages kept in the text cache
 
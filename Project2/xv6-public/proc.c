@@ -7,15 +7,24 @@
 #include "thread.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "slab.h"
+
+//* Wait queues. A SLEEPING process is linked into sleepq[SQHASH(chan)],
+//* so wakeup() only looks at processes that may be sleeping on chan
+//* instead of the whole table. Protected by ptable.lock.
+#define NSLEEPQ 61
+#define SQHASH(chan) (((uint)(chan) >> 2) % NSLEEPQ)
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *sleepq[NSLEEPQ];
 } ptable;
 
 uint iomutex = 0; //* 0 - not using, 1 - using
 
-thread_t threadlist[NPROC] = {0};
+//* Thread records come from a slab cache instead of a threadlist[NPROC].
+static struct kmem_cache threadcache;
 
 static struct proc *initproc;
 
@@ -35,6 +44,7 @@ void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  kmem_cache_init(&threadcache, "thread", sizeof(thread_t));
 }
 
 // Must be called with interrupts disabled
@@ -238,6 +248,16 @@ growproc(int n)
   return 0;
 }
 
+//* Give np the demand-paged segments of p; copyuvm() left the pages
+//* p had not touched yet unmapped in np too.
+static void
+lazycopy(struct proc *np, struct proc *p)
+{
+  np->lip = p->lip ? idup(p->lip) : 0;
+  np->nlseg = p->nlseg;
+  memmove(np->lseg, p->lseg, sizeof(p->lseg));
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -274,6 +294,7 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  lazycopy(np, curproc);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -312,8 +333,12 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->lip)
+    iput(curproc->lip);
   end_op();
   curproc->cwd = 0;
+  curproc->lip = 0;
+  curproc->nlseg = 0;
 
   acquire(&ptable.lock);
 
@@ -535,6 +560,11 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqprev = 0;
+  p->sqnext = ptable.sleepq[SQHASH(chan)];
+  if(p->sqnext)
+    p->sqnext->sqprev = p;
+  ptable.sleepq[SQHASH(chan)] = p;
 
   sched();
 
@@ -548,17 +578,34 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+//* Make the SLEEPING process p runnable, taking it off its wait queue.
+//* The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    ptable.sleepq[SQHASH(p->chan)] = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  p->sqnext = p->sqprev = 0;
+  p->state = RUNNABLE;
+}
+
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, *next;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(p = ptable.sleepq[SQHASH(chan)]; p; p = next){
+    next = p->sqnext;
+    if(p->chan == chan)
+      unsleep(p);
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -602,7 +649,7 @@ kill(int pid)
         }
       }
       if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+        unsleep(p);
       release(&ptable.lock);
       return 0;
     }
@@ -646,6 +693,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  textdump();
 }
 
 //* Project #2
@@ -716,27 +764,22 @@ setmemorylimit(int pid, int limit){
 int
 allocthread(thread_t *thread){
   struct proc* curproc = myproc();
-  struct thread_t* destthread;
+  struct thread_t* destthread = 0;
   uint sp = 0; 
   uint ustack[2]; //* size: basic stack 2:
 		  // fake return counter, address of argument, termination
   int tid = ++(curproc->thctr); //* Thread counter will be new thread id.
-  struct proc* newthread;
+  struct proc* newthread = 0;
   pde_t *pgdir = 0;
 
   //* Step 1) Thread init
-  //* Find Vacant Thread.
-  for(destthread = threadlist; destthread < &threadlist[NPROC]; destthread++){
-    if(destthread->occupied == 0){
-      break;
-    }
-  }
-  
-  if(destthread >= &threadlist[NPROC]){
+  //* Allocate a thread record.
+  if((destthread = kmem_cache_alloc(&threadcache)) == 0){
     //*Cannot find space.
     cprintf("Allocation Failed while finding thread space.\n");
     goto failed;
   }
+  memset(destthread, 0, sizeof(*destthread));
 
   //* Allocation
   thread->pid = curproc -> pid;
@@ -812,6 +855,7 @@ allocthread(thread_t *thread){
     }
   }
   newthread->cwd = idup(curproc->cwd);
+  lazycopy(newthread, curproc);
 
   //* 6) connect pgdir and miscellaneous things.
   //* copy name
@@ -833,6 +877,9 @@ failed:
   if(pgdir){ // * Free allocated paged bc failed.
     freevm(pgdir);
   }
+  if(destthread && !(newthread && newthread->thread == destthread)){
+    kmem_cache_free(&threadcache, destthread);
+  }
 
   cprintf("thread allocation failed\n");
   return -1;
@@ -846,6 +893,15 @@ terminatethread(void* retval){
   struct proc* curthread = myproc(); //* This process must be thread.
   //int fd;
 
+  //* Drop the program file now: cleanupthread() runs under ptable.lock.
+  if(curthread->lip){
+    begin_op();
+    iput(curthread->lip);
+    end_op();
+    curthread->lip = 0;
+    curthread->nlseg = 0;
+  }
+
   acquire(&ptable.lock);
   //* Step 1) set return value.
   curthread->thread->retval = retval;
@@ -932,6 +988,7 @@ cleanupthread(struct proc* tgtthread){
   tgtthread->thread->parent = 0;
   tgtthread->thread->arg = 0;
   tgtthread->thread->occupied = 0;
+  kmem_cache_free(&threadcache, tgtthread->thread);
   tgtthread->thread = 0;
 
 
@@ -964,7 +1021,7 @@ purgethreads(struct proc* p, struct proc* exception){
 	acquire(&ptable.lock);
 	tgt->killed = 1;
 	if(tgt->state == SLEEPING){
-	  tgt->state = RUNNABLE;
+	  unsleep(tgt);
 	}
 	release(&ptable.lock);
       }
@@ -37,6 +37,16 @@ struct context {
 };
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+//* An ELF segment exec() left to be paged in on first touch
+//* (vm.c lazyfault()): [va, end) in memory, the first filesz bytes
+//* of it read from the program file at off, the rest zero.
+struct lazyseg {
+  uint va;                     // page aligned
+  uint end;
+  uint off;
+  uint filesz;
+};
+
 // Per-process state
 //
 struct proc {
@@ -49,6 +59,10 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *sqnext;         //* wait queue of chan (ptable.sleepq)
+  struct proc *sqprev;
+  uint wakeat;                 //* sys_sleep deadline (trap.c timer wheel)
+  struct proc *tnext;
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
@@ -60,6 +74,9 @@ struct proc {
   struct thread_t *thread;      //* contains thread information.
   int thctr;			//* number of thread created: used for making new thread id.
   char *tstack;		       //* Top of thread stack for this process;
+  struct inode *lip;           //* program file backing lseg[]
+  struct lazyseg lseg[NLAZYSEG];
+  int nlseg;
   //struct thread_t* threads[100]; //* TODO: Need to remove Threads available.
   //int tgttid; 			//* shows target thread to schedule. -1 if there is no thread.
 };
@@ -0,0 +1,167 @@
+// Slab allocator for small kernel objects.
+//* Objects that are much smaller than a page (pipes, open files,
+//* inodes, thread records) come from per-type caches instead of a
+//* kalloc() page each or a fixed static table.
+//*
+//* A slab is one page: a struct slab header followed by perslab
+//* objects. The header of an object's slab is found by rounding the
+//* object's address down to the page, so a free needs no lookup.
+//* Slabs with free objects are on the cache's partial list; full slabs
+//* are on no list; one empty slab is kept, others go back to kalloc().
+//*
+//* In front of the slabs each CPU has a magazine of up to MAGSIZE free
+//* objects, used with interrupts off. Only when a magazine runs empty
+//* (or full) is the cache lock taken, to move MAGSIZE/2 objects at once.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;          //* partial list
+  struct slab *prev;
+  void *free;                 //* free objects, linked through their first word
+  uint inuse;
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+void
+kmem_cache_init(struct kmem_cache *c, char *name, uint size)
+{
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  if(c->size < sizeof(void*))
+    c->size = sizeof(void*);
+  c->perslab = (PGSIZE - SLABHDR) / c->size;
+  if(c->perslab == 0)
+    panic("kmem_cache_init: object too big");
+}
+
+static void
+partial_remove(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+partial_insert(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+//* Take one object from the slabs. Caller holds c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+  void *obj;
+  uint i;
+
+  if((s = c->partial) == 0){
+    if((s = c->empty) != 0){
+      c->empty = 0;
+    } else {
+      if((s = (struct slab*)kalloc()) == 0)
+        return 0;
+      s->cache = c;
+      s->free = 0;
+      s->inuse = 0;
+      p = (char*)s + SLABHDR;
+      for(i = 0; i < c->perslab; i++, p += c->size){
+        *(void**)p = s->free;
+        s->free = p;
+      }
+      c->nslab++;
+    }
+    partial_insert(c, s);
+  }
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  if(s->free == 0)
+    partial_remove(c, s);
+  return obj;
+}
+
+//* Give obj back to its slab. Caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    partial_insert(c, s);  //* was full
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(--s->inuse > 0)
+    return;
+  partial_remove(c, s);
+  if(c->empty == 0){
+    c->empty = s;
+    return;
+  }
+  c->nslab--;
+  kfree((char*)s);
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory. The object is not zeroed.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj, *o;
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  if(c->mag[cpu].n == 0){
+    acquire(&c->lock);
+    while(c->mag[cpu].n < MAGSIZE/2 && (o = slab_get(c)) != 0)
+      c->mag[cpu].obj[c->mag[cpu].n++] = o;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->mag[cpu].n > 0)
+    obj = c->mag[cpu].obj[--c->mag[cpu].n];
+  popcli();
+  return obj;
+}
+
+// Free an object allocated from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  if(c->mag[cpu].n == MAGSIZE){
+    acquire(&c->lock);
+    while(c->mag[cpu].n > MAGSIZE/2)
+      slab_put(c, c->mag[cpu].obj[--c->mag[cpu].n]);
+    release(&c->lock);
+  }
+  c->mag[cpu].obj[c->mag[cpu].n++] = obj;
+  popcli();
+}
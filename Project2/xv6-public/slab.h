@@ -0,0 +1,23 @@
+//* Object caches (slab.c).
+//* A cache hands out objects of one size, carved from kalloc() pages
+//* ("slabs"). Each CPU keeps a small magazine of free objects, so most
+//* allocations and frees touch no lock at all.
+//* Needs param.h and spinlock.h.
+
+#define MAGSIZE 8             //* objects per per-CPU magazine
+
+struct slab;
+
+struct kmem_cache {
+  struct spinlock lock;       //* protects the slab lists
+  char *name;
+  uint size;                  //* object size, rounded up
+  uint perslab;               //* objects per slab
+  struct slab *partial;       //* slabs with free and used objects
+  struct slab *empty;         //* one all-free slab kept back
+  int nslab;                  //* slabs in use by this cache
+  struct {
+    int n;
+    void *obj[MAGSIZE];
+  } mag[NCPU];
+};
@@ -80,6 +80,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(lazytouch(curproc, i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
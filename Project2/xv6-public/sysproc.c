@@ -61,18 +61,24 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct proc *p = myproc();
 
   if(argint(0, &n) < 0)
     return -1;
+  if(n <= 0)
+    return 0;
+  //* Wait for our own timer on the wheel (trap.c) rather than
+  //* being woken on every tick.
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
+  p->wakeat = ticks + n;
+  timer_add(p);
+  while((int)(ticks - p->wakeat) < 0){
+    if(p->killed){
+      timer_del(p);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&p->wakeat, &tickslock);
   }
   release(&tickslock);
   return 0;
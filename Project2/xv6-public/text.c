@@ -0,0 +1,222 @@
+// Program text cache.
+//* Pages that lazyfault() reads from a program file are kept here,
+//* keyed by (dev, inum, file offset, length), and mapped read-only
+//* (PTE_SH) into every process running that program; a write to
+//* one is copied to a private page first (vm.c textcow()). So N
+//* copies of sh cost its pages once, and a later exec of a cached
+//* program reads nothing from disk.
+//*
+//* users counts the page tables mapping a page. Pages no process
+//* uses stay cached until textreclaim() needs the memory or the
+//* slot; writing or truncating the file drops its pages. ip->ntext
+//* lets the writes of files that have no cached pages skip the scan.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct tpage {
+  uint dev;
+  uint inum;            // 0: stale, freed once users reaches 0
+  uint off;
+  uint n;
+  char *mem;            // 0: slot free
+  int users;
+};
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTPAGE];
+  uint hits;            //* textget() found the page
+  uint misses;          //* textget() sent the caller to the disk
+} tcache;
+
+void
+textinit(void)
+{
+  initlock(&tcache.lock, "text");
+}
+
+static struct tpage*
+tfind(uint pa)
+{
+  struct tpage *t;
+
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++)
+    if(t->mem && V2P(t->mem) == pa)
+      return t;
+  panic("text: page not cached");
+}
+
+//* The cached page for n bytes of ip at off, with one more user;
+//* 0 if it is not cached.
+char*
+textget(struct inode *ip, uint off, uint n)
+{
+  struct tpage *t;
+  char *mem;
+
+  mem = 0;
+  acquire(&tcache.lock);
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++){
+    if(t->mem && t->inum == ip->inum && t->dev == ip->dev &&
+       t->off == off && t->n == n){
+      t->users++;
+      mem = t->mem;
+      break;
+    }
+  }
+  if(mem)
+    tcache.hits++;
+  else
+    tcache.misses++;
+  release(&tcache.lock);
+  return mem;
+}
+
+//* Cache mem, just read from ip, with one user. Returns the page to
+//* map: mem, or an equal page another process cached first (then
+//* mem is freed), or 0 if there is no free slot (mem stays private).
+char*
+textadd(struct inode *ip, uint off, uint n, char *mem)
+{
+  struct tpage *t, *slot;
+
+  slot = 0;
+  acquire(&tcache.lock);
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++){
+    if(t->mem && t->inum == ip->inum && t->dev == ip->dev &&
+       t->off == off && t->n == n){
+      t->users++;
+      release(&tcache.lock);
+      kfree(mem);
+      return t->mem;
+    }
+    if(slot == 0 && (t->mem == 0 || (t->users == 0 && t->inum)))
+      slot = t;
+  }
+  if(slot == 0){
+    release(&tcache.lock);
+    return 0;
+  }
+  if(slot->mem)
+    kfree(slot->mem);
+  slot->dev = ip->dev;
+  slot->inum = ip->inum;
+  slot->off = off;
+  slot->n = n;
+  slot->mem = mem;
+  slot->users = 1;
+  ip->ntext++;
+  release(&tcache.lock);
+  return mem;
+}
+
+//* Another page table maps the cached page at pa.
+void
+textdup(uint pa)
+{
+  acquire(&tcache.lock);
+  tfind(pa)->users++;
+  release(&tcache.lock);
+}
+
+//* A page table stopped mapping the cached page at pa.
+void
+textput(uint pa)
+{
+  struct tpage *t;
+
+  acquire(&tcache.lock);
+  t = tfind(pa);
+  if(--t->users == 0 && t->inum == 0){
+    kfree(t->mem);
+    t->mem = 0;
+  }
+  release(&tcache.lock);
+}
+
+//* ip's contents are changing: forget its pages. Pages still mapped
+//* keep the old contents until their processes let go. Pages freed
+//* elsewhere leave ntext too high, which only costs a scan here.
+void
+textinval(struct inode *ip)
+{
+  struct tpage *t;
+
+  if(ip->ntext == 0)
+    return;
+  acquire(&tcache.lock);
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++){
+    if(t->mem && t->inum == ip->inum && t->dev == ip->dev){
+      t->inum = 0;
+      if(t->users == 0){
+        kfree(t->mem);
+        t->mem = 0;
+      }
+    }
+  }
+  ip->ntext = 0;
+  release(&tcache.lock);
+}
+
+//* How many pages of ip are cached; for a freshly loaded inode.
+int
+textcount(struct inode *ip)
+{
+  struct tpage *t;
+  int n;
+
+  n = 0;
+  acquire(&tcache.lock);
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++)
+    if(t->mem && t->inum == ip->inum && t->dev == ip->dev)
+      n++;
+  release(&tcache.lock);
+  return n;
+}
+
+//* Free the cached pages no process maps. Returns how many.
+int
+textreclaim(void)
+{
+  struct tpage *t;
+  int n;
+
+  n = 0;
+  acquire(&tcache.lock);
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++){
+    if(t->mem && t->users == 0){
+      kfree(t->mem);
+      t->mem = 0;
+      n++;
+    }
+  }
+  release(&tcache.lock);
+  return n;
+}
+
+//* Print the cache counters; part of the ^P listing. No lock, like
+//* procdump().
+void
+textdump(void)
+{
+  struct tpage *t;
+  int n, users;
+
+  n = users = 0;
+  for(t = tcache.page; t < &tcache.page[NTPAGE]; t++){
+    if(t->mem){
+      n++;
+      users += t->users;
+    }
+  }
+  cprintf("text cache: %d pages, %d mappings, %d hits, %d misses\n",
+          n, users, tcache.hits, tcache.misses);
+}
@@ -14,6 +14,56 @@ extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
 
+//* Timer wheel for sys_sleep. A sleeper is hashed into the slot of its
+//* deadline and each slot is kept sorted, so a tick only looks at the
+//* head of one slot instead of waking every sleeper to re-check ticks.
+//* Protected by tickslock.
+#define NTIMER 64
+static struct proc *timerwheel[NTIMER];
+
+//* Queue p to be woken at p->wakeat. Caller holds tickslock.
+void
+timer_add(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &timerwheel[p->wakeat % NTIMER]; *pp; pp = &(*pp)->tnext)
+    if((int)((*pp)->wakeat - p->wakeat) > 0)
+      break;
+  p->tnext = *pp;
+  *pp = p;
+}
+
+//* Take p off the wheel if it is still queued. Caller holds tickslock.
+void
+timer_del(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &timerwheel[p->wakeat % NTIMER]; *pp; pp = &(*pp)->tnext){
+    if(*pp == p){
+      *pp = p->tnext;
+      break;
+    }
+  }
+  p->tnext = 0;
+}
+
+//* Wake the sleepers whose deadline is the current tick.
+//* Caller holds tickslock.
+static void
+timer_expire(void)
+{
+  struct proc **pp, *p;
+
+  pp = &timerwheel[ticks % NTIMER];
+  while((p = *pp) != 0 && (int)(ticks - p->wakeat) >= 0){
+    *pp = p->tnext;
+    p->tnext = 0;
+    wakeup(&p->wakeat);
+  }
+}
+
 void
 tvinit(void)
 {
@@ -64,7 +114,7 @@ trap(struct trapframe *tf)
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      timer_expire();
       release(&tickslock);
     }
     lapiceoi();
@@ -91,6 +141,19 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  //* A page of a demand-paged program (exec.c). Faults from the
+  //* kernel are served only when no spinlock is held, since reading
+  //* the page may sleep; argptr() pages buffers in ahead of time.
+  case T_PGFLT:
+    //* A write to a shared text page (present, write: err 3).
+    if(myproc() && (tf->err & 3) == 3 &&
+       textcow(myproc()->pgdir, rcr2()) == 0)
+      break;
+    if(myproc() && ((tf->cs&3) == DPL_USER || mycpu()->ncli == 0) &&
+       lazyfault(myproc(), rcr2()) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
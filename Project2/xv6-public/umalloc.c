@@ -3,30 +3,49 @@
 #include "user.h"
 #include "param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+//* Size-class allocator.
+//*
+//* Blocks of up to MAXSMALL bytes (header included) come from one of
+//* NCLASS power-of-two classes. Each class has its own free list, so
+//* malloc() and free() of a small block are a list pop and push. An
+//* empty class is refilled by carving a CHUNK fresh from sbrk().
+//*
+//* Larger blocks live on the coalescing free list of the Kernighan
+//* and Ritchie allocator (The C Programming Language, 2nd ed.,
+//* Section 8.7), which only ever holds large blocks. They are handed
+//* out best fit, and the list grows by what the request needs rather
+//* than 4096 units at a time.
+//*
+//* LWP threads get a copy of the address space (copyuvm()), so each
+//* thread already has its own lists and no locking is needed.
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;          // in units of sizeof(Header), header included
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define NCLASS    8                         // 16 .. 2048 bytes
+#define MINUNITS  2                         // smallest class, in units
+#define MAXSMALL  (MINUNITS << (NCLASS-1))  // largest class, in units
+#define CHUNK     4096                      // bytes sbrk()ed per refill
+
+static Header *classes[NCLASS];
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static void
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -49,42 +68,110 @@ morecore(uint nu)
   char *p;
   Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
+  nu = (nu * sizeof(Header) + CHUNK - 1) / CHUNK * CHUNK / sizeof(Header);
   p = sbrk(nu * sizeof(Header));
   if(p == (char*)-1)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+//* Best fit: the smallest free block that is large enough.
+static void*
+lmalloc(uint nunits)
 {
-  Header *p, *prevp;
-  uint nunits;
+  Header *p, *prevp, *best, *bestprev;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
+  if(freep == 0){
+    base.s.ptr = freep = &base;
     base.s.size = 0;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
+  for(;;){
+    best = bestprev = 0;
+    prevp = freep;
+    do {
+      p = prevp->s.ptr;
+      if(p->s.size >= nunits && (best == 0 || p->s.size < best->s.size)){
+        best = p;
+        bestprev = prevp;
+        if(p->s.size == nunits)
+          break;
+      }
+      prevp = p;
+    } while(prevp != freep);
+    if(best){
+      p = best;
       if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
+        bestprev->s.ptr = p->s.ptr;
       else {
         p->s.size -= nunits;
         p += p->s.size;
         p->s.size = nunits;
       }
-      freep = prevp;
+      freep = bestprev;
       return (void*)(p + 1);
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    if(morecore(nunits) == 0)
+      return 0;
+  }
+}
+
+// Fill class c's empty free list from one fresh chunk.
+static int
+refill(int c)
+{
+  Header *p, *end;
+  uint units;
+
+  units = MINUNITS << c;
+  p = (Header*)sbrk(CHUNK);
+  if(p == (Header*)-1)
+    return -1;
+  end = p + CHUNK / sizeof(Header);
+  for(; p + units <= end; p += units){
+    p->s.size = units;
+    p->s.ptr = classes[c];
+    classes[c] = p;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  int c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size > MAXSMALL){
+    lfree(bp);
+    return;
   }
+  for(c = 0; (MINUNITS << c) < bp->s.size; c++)
+    ;
+  bp->s.ptr = classes[c];
+  classes[c] = bp;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+  int c;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits > MAXSMALL)
+    return lmalloc(nunits);
+  for(c = 0; (MINUNITS << c) < nunits; c++)
+    ;
+  if(classes[c] == 0 && refill(c) < 0)
+    return 0;
+  p = classes[c];
+  classes[c] = p->s.ptr;
+  return (void*)(p + 1);
 }
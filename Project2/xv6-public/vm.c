@@ -216,6 +216,113 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
   return 0;
 }
 
+//* Page in the demand-paged program page holding va for p.
+//* Returns 0 if it is mapped now, -1 if va is not in a lazy segment.
+//* May sleep on the program file, so no spinlock may be held.
+//* File-backed pages are shared read-only through the text cache.
+int
+lazyfault(struct proc *p, uint va)
+{
+  struct lazyseg *ls;
+  pte_t *pte;
+  char *mem, *shared;
+  uint n, off;
+  int perm;
+
+  if(va >= p->sz)
+    return -1;
+  va = PGROUNDDOWN(va);
+  for(ls = p->lseg; ls < &p->lseg[p->nlseg]; ls++)
+    if(va >= ls->va && va < ls->end)
+      break;
+  if(ls == &p->lseg[p->nlseg] || p->lip == 0)
+    return -1;
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return 0;
+
+  n = 0;
+  off = ls->off + (va - ls->va);
+  if(va - ls->va < ls->filesz){
+    n = ls->filesz - (va - ls->va);
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+  perm = PTE_W|PTE_U;
+  if(n > 0 && (mem = textget(p->lip, off, n)) != 0)
+    perm = PTE_U|PTE_SH;
+  else {
+    if((mem = kalloc()) == 0 && (textreclaim() == 0 || (mem = kalloc()) == 0))
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(n > 0){
+      ilock(p->lip);
+      if(readi(p->lip, mem, off, n) != n){
+        iunlock(p->lip);
+        kfree(mem);
+        return -1;
+      }
+      iunlock(p->lip);
+      if((shared = textadd(p->lip, off, n, mem)) != 0){
+        mem = shared;
+        perm = PTE_U|PTE_SH;
+      }
+    }
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    if(perm & PTE_SH)
+      textput(V2P(mem));
+    else
+      kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+//* Replace the shared text page at va in pgdir by a private,
+//* writable copy, before it is written. Returns -1 if va is not a
+//* shared text page. Does not sleep.
+int
+textcow(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+  uint pa;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (char*)va, 0)) == 0 ||
+     (*pte & (PTE_P|PTE_U|PTE_SH)) != (PTE_P|PTE_U|PTE_SH))
+    return -1;
+  if((mem = kalloc()) == 0 && (textreclaim() == 0 || (mem = kalloc()) == 0))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  memmove(mem, P2V(pa), PGSIZE);
+  *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+  if(myproc() && myproc()->pgdir == pgdir)
+    lcr3(V2P(pgdir));  // flush the read-only entry from the TLB
+  textput(pa);
+  return 0;
+}
+
+//* Page in the lazy pages of [va, va+n) now, for system calls that
+//* touch user memory while holding a spinlock (e.g. pipewrite()).
+int
+lazytouch(struct proc *p, uint va, uint n)
+{
+  struct lazyseg *ls;
+  uint a, last;
+
+  if(p->nlseg == 0 || n == 0)
+    return 0;
+  last = PGROUNDDOWN(va + n - 1);
+  for(a = PGROUNDDOWN(va); ; a += PGSIZE){
+    for(ls = p->lseg; ls < &p->lseg[p->nlseg]; ls++)
+      if(a >= ls->va && a < ls->end && lazyfault(p, a) < 0)
+        return -1;
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -270,8 +377,12 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      if(*pte & PTE_SH)
+        textput(pa);
+      else {
+        char *v = P2V(pa);
+        kfree(v);
+      }
       *pte = 0;
     }
   }
@@ -323,12 +434,21 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
+    //* Program pages not paged in yet stay that way in the copy;
+    //* the copy's own lazyseg[] brings them in.
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+      continue;
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    //* A text cache page is mapped again, not copied.
+    if(flags & PTE_SH){
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+        goto bad;
+      textdup(pa);
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -420,10 +540,15 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    //* Never write through to a shared text page.
+    if((pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_SH) &&
+       textcow(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -25,6 +25,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kprof.h"
 
 struct {
   struct spinlock lock;
@@ -62,7 +63,9 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  uint t0;
 
+  t0 = kprof_start();
   acquire(&bcache.lock);
 
   // Is the block already cached?
@@ -71,6 +74,7 @@ bget(uint dev, uint blockno)
       b->refcnt++;
       release(&bcache.lock);
       acquiresleep(&b->lock);
+      kprof_end(KP_BGET, t0);
       return b;
     }
   }
@@ -86,6 +90,7 @@ bget(uint dev, uint blockno)
       b->refcnt = 1;
       release(&bcache.lock);
       acquiresleep(&b->lock);
+      kprof_end(KP_BGET, t0);
       return b;
     }
   }
@@ -105,6 +110,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+//* Return a locked, zeroed buf for a block the caller is about to
+//* overwrite entirely, without reading the old contents from disk.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -9,10 +10,12 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct trapframe;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bclaim(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -31,16 +34,23 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+void            dcache_drop(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
+int             dirfull(struct inode*, char*);
+int             dirgrow(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
+void            ireclaim(void);
+void            iorphans(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -48,13 +58,13 @@ void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
+struct inode*   nameinf(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
+int             symwrite(struct inode*, char*);
 int             writei(struct inode*, char*, uint, uint);
-
-//* sysfile.c
-struct inode*	followip(struct inode*, char*);
+int             writecost(struct inode*, uint, uint);
 
 // ide.c
 void            ideinit(void);
@@ -75,6 +85,12 @@ void            kinit2(void*, void*);
 // kbd.c
 void            kbdintr(void);
 
+// profile.c
+uint            kprof_start(void);
+void            kprof_end(int, uint);
+void            kprofinit(void);
+void            ksample(struct trapframe*);
+
 // lapic.c
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
@@ -88,7 +104,14 @@ void            microdelay(int);
 void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
+void            end_opn(int);
+int             log_bulkmax(void);
+void            log_free(uint);
+int             log_reusable(uint);
+void            log_waitinstall(void);
+void            logd(void);
 
 // mp.c
 extern int      ismp;
@@ -111,6 +134,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kproc(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -133,6 +157,7 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -174,6 +199,21 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// mmap.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_dup(char*);
+void            pcache_put(char*);
+int             pcache_read(struct inode*, char*, uint, uint);
+void            pcache_write(struct inode*, char*, uint, uint);
+void            pcache_inval(uint, uint);
+int             mmap(struct file*, uint, int, int, uint);
+int             mmapfault(struct proc*, uint, int);
+int             mmapuva(uint, uint, int);
+int             munmap(uint, uint);
+void            munmapall(struct proc*, pde_t*);
+int             mmapdup(struct proc*, struct proc*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -189,6 +229,8 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
 
 //* Project #3
 //* log.c
@@ -0,0 +1,97 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "uio.h"
+
+#define NREC            64
+#define RECSIZE         100
+
+char hdr[12];
+char rec[RECSIZE];
+char buf[RECSIZE];
+
+static void
+fail(char *msg)
+{
+  printf(1, "dev_iov: %s failed\n", msg);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, j, off;
+  char *path = (argc > 1) ? argv[1] : "iovfile";
+  struct iovec iov[2];
+
+  printf(1, "test_iov starting\n");
+
+  printf(1, "1. writev header + record\n");
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0)
+    fail("open");
+  for(i = 0; i < NREC; i++){
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 'R';
+    hdr[1] = i;
+    for(j = 0; j < RECSIZE; j++)
+      rec[j] = (i + j) % 128;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = rec;
+    iov[1].iov_len = sizeof(rec);
+    if(writev(fd, iov, 2) != sizeof(hdr) + sizeof(rec))
+      fail("writev");
+  }
+
+  printf(1, "2. pread at random offsets\n");
+  for(i = NREC - 1; i >= 0; i -= 7){
+    off = i * (sizeof(hdr) + RECSIZE) + sizeof(hdr);
+    if(pread(fd, buf, RECSIZE, off) != RECSIZE)
+      fail("pread");
+    for(j = 0; j < RECSIZE; j++)
+      if(buf[j] != (i + j) % 128)
+        fail("pread data");
+  }
+  // pread/pwrite must not move the file offset
+  if(write(fd, "E", 1) != 1)
+    fail("write after pread");
+
+  printf(1, "3. pwrite in place\n");
+  off = 3 * (sizeof(hdr) + RECSIZE) + sizeof(hdr);
+  if(pwrite(fd, "patched", 7, off) != 7)
+    fail("pwrite");
+  if(pwrite(fd, "x", 1, 1 << 30) >= 0)
+    fail("pwrite past end");
+  close(fd);
+
+  printf(1, "4. readv records back\n");
+  if((fd = open(path, O_RDONLY)) < 0)
+    fail("reopen");
+  for(i = 0; i < NREC; i++){
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = sizeof(buf);
+    if(readv(fd, iov, 2) != sizeof(hdr) + sizeof(buf))
+      fail("readv");
+    if(hdr[0] != 'R' || hdr[1] != i)
+      fail("readv header");
+    if(i == 3){
+      for(j = 0; j < 7; j++)
+        if(buf[j] != "patched"[j])
+          fail("pwrite data");
+      continue;
+    }
+    for(j = 0; j < RECSIZE; j++)
+      if(buf[j] != (i + j) % 128)
+        fail("readv data");
+  }
+  if(read(fd, buf, 2) != 1 || buf[0] != 'E')
+    fail("file offset");
+  close(fd);
+  unlink(path);
+
+  printf(1, "test_iov ok\n");
+  exit();
+}
@@ -0,0 +1,112 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+#define FILESIZE        (64*1024)  // 64 KB
+#define PGSIZE          4096
+
+char buf[512];
+
+static void
+fail(char *msg)
+{
+  printf(1, "dev_mmap: %s failed\n", msg);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, cp, i, j, pid;
+  char *path = (argc > 1) ? argv[1] : "mmapfile";
+  char *p, *q;
+
+  printf(1, "test_mmap starting\n");
+
+  printf(1, "1. create test file\n");
+  if((fd = open(path, O_CREATE | O_RDWR)) < 0)
+    fail("open");
+  for(i = 0; i < FILESIZE / sizeof(buf); i++){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = (i + j) % 128;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("write");
+  }
+  close(fd);
+
+  printf(1, "2. private mapping\n");
+  fd = open(path, O_RDONLY);
+  if((p = mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    fail("mmap private");
+  for(i = 0; i < FILESIZE; i++)
+    if(p[i] != (i / sizeof(buf) + i % sizeof(buf)) % 128)
+      fail("private read");
+  p[0] = 'X';  // stays in this process
+  if((cp = open("mmapcopy", O_CREATE | O_RDWR)) < 0 || write(cp, p, FILESIZE) != FILESIZE)
+    fail("write() from a mapping");
+  close(cp);
+  unlink("mmapcopy");
+  if(munmap(p, FILESIZE) < 0)
+    fail("munmap private");
+  if(read(fd, buf, 1) != 1 || buf[0] != 0)
+    fail("private write leaked");
+  close(fd);
+
+  printf(1, "3. shared mapping\n");
+  fd = open(path, O_RDWR);
+  if((p = mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PGSIZE)) == MAP_FAILED)
+    fail("mmap shared");
+  close(fd);  // the mapping keeps the file
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < PGSIZE; i++)
+      p[i] = 'c';
+    exit();
+  }
+  wait();
+  for(i = 0; i < PGSIZE; i++)
+    if(p[i] != 'c')
+      fail("shared page from child");
+  if((q = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, (fd = open(path, O_RDONLY)), PGSIZE)) == MAP_FAILED)
+    fail("second mmap");
+  if(q[10] != 'c')
+    fail("second mapping sees the store");
+  munmap(q, PGSIZE);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 0)
+    fail("read before the mapped range");
+  close(fd);
+  if(munmap(p, FILESIZE) < 0)
+    fail("munmap shared");
+
+  fd = open(path, O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf))
+    fail("read back");
+  for(i = 0; i < PGSIZE / sizeof(buf) - 1; i++)
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("read back");
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'c' || buf[511] != 'c')
+    fail("shared store reached the file");
+  close(fd);
+
+  printf(1, "4. kernel stores into a read-only mapping\n");
+  fd = open(path, O_RDONLY);
+  if((q = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    fail("read-only mmap");
+  if(fstat(fd, (struct stat*)q) >= 0)
+    fail("fstat() into a read-only mapping");
+  if(pipe((int*)q) >= 0)
+    fail("pipe() into a read-only mapping");
+  if(read(fd, q, sizeof(buf)) >= 0)
+    fail("read() into a read-only mapping");
+  if(write(1, q, 0) < 0)
+    fail("write() from a read-only mapping");
+  munmap(q, PGSIZE);
+  close(fd);
+
+  unlink(path);
+  printf(1, "test_mmap ok\n");
+  exit();
+}
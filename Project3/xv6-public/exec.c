@@ -27,20 +27,8 @@ exec(char *path, char **argv)
     return -1;
   }
 
-  //* follow path if current ip is symbolic link
-  ////* follow path if current ip is symbolic link;;
-  //ip = followip(ip, path);
-
-
+  //* namei() has already followed any symbolic links.
   ilock(ip);
-  ip = followip(ip, path);
-
-  if(ip == 0){
-    //iunlock(ip);
-    end_op();
-    cprintf("exec: file corrupted.\n");
-    return -1;
-  }
   pgdir = 0;
 
   // Check ELF header
@@ -114,6 +102,7 @@ exec(char *path, char **argv)
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
+  munmapall(curproc, oldpgdir);  //* mappings do not survive exec
   freevm(oldpgdir);
   return 0;
 
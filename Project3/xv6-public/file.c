@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -96,18 +97,51 @@ filestat(struct file *f, struct stat *st)
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+//* Read into the iovcnt buffers of iov in order, from offset off,
+//* or from (and advancing) f->off when off < 0.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i, r, tot;
+  uint o;
 
   if(f->readable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    //* Another piperead() could block on a drained pipe, so fill
+    //* only the first non-empty buffer; a short readv() is allowed.
+    for(i = 0; i < iovcnt; i++)
+      if(iov[i].iov_len > 0)
+        return piperead(f->pipe, iov[i].iov_base, iov[i].iov_len);
+    return 0;
+  }
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    o = off < 0 ? f->off : off;
+    tot = 0;
+    for(i = 0; i < iovcnt; i++){
+      if((r = readi(f->ip, iov[i].iov_base, o + tot, iov[i].iov_len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
+    if(off < 0 && tot > 0)
+      f->off += tot;
     iunlock(f->ip);
-    return r;
+    return tot;
   }
   panic("fileread");
 }
@@ -117,12 +151,34 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+//* Write the iovcnt buffers of iov in order, at offset off,
+//* or at (and advancing) f->off when off < 0.
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i, r, n, n1, tot, done, left, want, res;
+  uint o;
 
   if(f->writable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    tot = 0;
+    for(i = 0; i < iovcnt; i++){
+      if((r = pipewrite(f->pipe, iov[i].iov_base, iov[i].iov_len)) < 0)
+        return -1;
+      tot += r;
+    }
+    return tot;
+  }
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -131,28 +187,60 @@ filewrite(struct file *f, char *addr, int n)
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+    //* Larger writes reserve log space in proportion to what they
+    //* will log (see writecost()), up to log_bulkmax() blocks per
+    //* transaction. New file blocks are written home rather than
+    //* logged, so appends mostly pay for metadata. The estimate made
+    //* before locking is checked again once the inode is locked.
+    //* The buffers land back to back in the file, so one transaction
+    //* can take several of them.
+    for(left = 0, i = 0; i < iovcnt; i++)
+      left += iov[i].iov_len;
+    tot = 0;
+    i = done = 0;
+    r = n1 = 0;
+    while(i < iovcnt){
+      o = off < 0 ? f->off : off + tot;
+      for(want = left - tot; want > max; want /= 2)
+        if((res = writecost(f->ip, o, want)) <= log_bulkmax())
+          break;
+      if(want <= max){
+        want = left - tot < max ? left - tot : max;
+        res = MAXOPBLOCKS;
+      } else if(res < MAXOPBLOCKS)
+        res = MAXOPBLOCKS;  //* enough for a max-byte piece if want shrinks
+      begin_opn(res);
       ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      o = off < 0 ? f->off : off + tot;
+      while(want > max && writecost(f->ip, o, want) > res)
+        want /= 2;
+      for(n = 0; i < iovcnt && n < want; n += r){
+        n1 = iov[i].iov_len - done;
+        if(n1 > want - n)
+          n1 = want - n;
+        if((r = writei(f->ip, (char*)iov[i].iov_base + done, o + n, n1)) != n1){
+          if(r > 0)
+            n += r;  //* short: the disk is full
+          break;
+        }
+        done += r;
+        if(done == iov[i].iov_len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off += n;
+      tot += n;
       iunlock(f->ip);
-      end_op();
+      end_opn(res);
 
-      if(r < 0){
-        //cprintf("error after return on writei");
-        break;
-      }
       if(r != n1)
-        panic("short filewrite");
-      i += r;
+        break;  //* error, or the disk is full
     }
-    return i == n ? n : -1;
+    if(i < iovcnt && (r < 0 || tot == 0))
+      return -1;
+    return tot;
   }
   panic("filewrite");
 }
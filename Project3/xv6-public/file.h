@@ -14,17 +14,29 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  //* icache hash chain
+  struct inode *lprev;  //* icache LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint goal;          //* block after the last one allocated (balloc hint)
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
-  uint D_addr;	      //* double indirect
-  uint T_addr;	      //* triple indirect
+  union {
+    struct {
+      uint addrs[NDIRECT+1];
+      uint D_addr;	      //* double indirect
+      uint T_addr;	      //* triple indirect
+    };
+    struct {
+      struct exthdr eh;     //* extent tree root
+      struct extent ex[EXT_ROOTMAX];
+    };
+  };
 };
 
 // table mapping major device number to
@@ -37,4 +49,6 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define KPROF 2    //* profile.c probe counters
+#define SPROF 3    //* profile.c timer samples
 
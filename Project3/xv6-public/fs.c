@@ -22,7 +22,21 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-static void itrunc(struct inode*);
+static int itrunc(struct inode*, int);
+static void reclaim_queue(struct inode*);
+static void dcache_init(void);
+static void dcache_purge(uint, uint);
+static uint bmapd(struct inode*, uint, int);
+//* Log blocks one itrunc() may dirty besides bitmap blocks: the index
+//* blocks it partly clears, all on the path to where it stops (3 for a
+//* block map, EXT_MAXDEPTH for extents), and the inode.
+#define ITRUNC_META (EXT_MAXDEPTH + 1)
+#define ITRUNC_INLINE (2 + ITRUNC_META) //* log blocks iput() may dirty
+#define ITRUNC_STEP MAXOPBLOCKS         //* ... and each reclaimer transaction
+//* Blocks one dirgrow() step dirties: the new directory block as
+//* writecost() counts it (block, inode, 2 bitmap, EXT_MAXDEPTH index),
+//* the block it splits and the parent index block.
+#define DXGROWBLOCKS (1 + 1 + 2 + EXT_MAXDEPTH + 2)
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -52,46 +66,203 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+//* Block allocator state kept only in memory.
+//* nfree[] counts the free bits of each bitmap block so balloc() skips
+//* full ones without reading them (-1: not counted yet), and hint[] is
+//* the lowest bit in each bitmap block that may still be free.
+//* A reservation window keeps the blocks right after an appending file's
+//* tail for that file; other files allocate around it, so files written
+//* at the same time do not interleave. Windows are soft: nothing is
+//* marked on disk, and if the disk is nearly full they are ignored.
+#define NBMAP (FSSIZE/BPB + 1)  //* bitmap blocks tracked by the summary
+#define NRESV 16                //* reservation windows
+#define RESVBLKS 16             //* size of a reservation window
+
+struct {
+  struct spinlock lock;         //* protects resv[]
+  int nfree[NBMAP];
+  uint hint[NBMAP];
+  struct {
+    struct inode *ip;           //* owner; 0 if unused
+    uint start, end;            //* reserved blocks [start, end)
+  } resv[NRESV];
+  int nextresv;                 //* next window to recycle
+} bmcache;
+
+//* Inodes waiting for ireclaim() to finish truncating them.
+struct {
+  struct spinlock lock;
+  struct inode *q[NINODE];
+  int n;
+} reclaim;
+
+//* Reserve [start, start+RESVBLKS) for ip, moving its window if it has one.
+static void
+resv_set(struct inode *ip, uint start)
+{
+  int i, slot;
+
+  acquire(&bmcache.lock);
+  slot = -1;
+  for(i = 0; i < NRESV; i++){
+    if(bmcache.resv[i].ip == ip){
+      slot = i;
+      break;
+    }
+    if(slot < 0 && bmcache.resv[i].ip == 0)
+      slot = i;
+  }
+  if(slot < 0)
+    slot = bmcache.nextresv++ % NRESV;
+  bmcache.resv[slot].ip = ip;
+  bmcache.resv[slot].start = start;
+  bmcache.resv[slot].end = start + RESVBLKS;
+  release(&bmcache.lock);
+}
+
+//* Give up ip's reservation window, if any.
+static void
+resv_drop(struct inode *ip)
+{
+  int i;
+
+  acquire(&bmcache.lock);
+  for(i = 0; i < NRESV; i++)
+    if(bmcache.resv[i].ip == ip)
+      bmcache.resv[i].ip = 0;
+  release(&bmcache.lock);
+}
+
+//* If b is inside a window reserved for another inode on ip's
+//* device, return the end of that window; otherwise 0.
+static uint
+resv_end(struct inode *ip, uint b)
+{
+  int i;
+  uint end;
+
+  end = 0;
+  acquire(&bmcache.lock);
+  for(i = 0; i < NRESV; i++){
+    if(bmcache.resv[i].ip && bmcache.resv[i].ip != ip &&
+       bmcache.resv[i].ip->dev == ip->dev &&
+       b >= bmcache.resv[i].start && b < bmcache.resv[i].end){
+      end = bmcache.resv[i].end;
+      break;
+    }
+  }
+  release(&bmcache.lock);
+  return end;
+}
+
+//* Count the free bits of bitmap block bp, which covers blocks [b, b+BPB).
+static int
+bcount(struct buf *bp, uint b)
+{
+  int bi, n;
+
+  n = 0;
+  for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+      n++;
+  return n;
+}
+
+//* Scan the bitmap for a free block, starting at goal and wrapping
+//* around. The goal's bitmap block is visited first and again last,
+//* so the bits in front of the goal are not skipped. If honor is set,
+//* blocks inside other inodes' reservation windows are passed over;
+//* if direct is set, so are blocks log_reusable() refuses.
+//* Returns the marked block, or 0 if none was found.
 static uint
-balloc(uint dev)
+bscan(struct inode *ip, uint goal, int honor, int direct)
 {
-  int b, bi, m;
+  int bi, m, k, g, nbmap;
+  uint b, end;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  nbmap = (sb.size + BPB - 1) / BPB;
+  for(k = 0; k <= nbmap; k++){
+    g = (goal / BPB + k) % nbmap;
+    if(g < NBMAP && bmcache.nfree[g] == 0)  //* full, skip without reading
+      continue;
+    b = g * BPB;
+    bp = bread(ip->dev, BBLOCK(b, sb));
+    if(g < NBMAP && bmcache.nfree[g] < 0){
+      bmcache.nfree[g] = bcount(bp, b);
+      bmcache.hint[g] = 0;
+    }
+    bi = (k == 0) ? goal % BPB : 0;
+    if(g < NBMAP && bi < bmcache.hint[g])
+      bi = bmcache.hint[g];
+    for(; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+      if((bp->data[bi/8] & m) != 0)
+        continue;
+      if(honor && (end = resv_end(ip, b + bi)) != 0){
+        bi = end - b - 1;  //* resume after the window
+        continue;
+      }
+      if(direct && !log_reusable(b + bi))
+        continue;
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      if(g < NBMAP){
+        bmcache.nfree[g]--;
+        if(bi == bmcache.hint[g])
+          bmcache.hint[g] = bi + 1;
       }
+      brelse(bp);
+      return b + bi;
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return 0;
 }
 
-// Free a disk block.
-static void
-bfree(int dev, uint b)
+// Allocate a zeroed disk block.
+//* The block is placed as close after goal as possible; with goal 0 it
+//* goes after the last block allocated for ip, or for a file that has not
+//* allocated yet, into a region picked by its inode number.
+//* With direct set the block is for file data that writei() writes home
+//* itself: it is not zeroed through the log, and it is one that
+//* log_reusable() accepts. writecost() does not count such blocks, so
+//* there is no falling back to a logged one: if the disk has no
+//* reusable block left, even after the committed transaction's frees
+//* are installed, ballocd() returns 0.
+static uint
+ballocd(struct inode *ip, uint goal, int direct)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  uint b;
+
+  if(goal == 0)
+    goal = ip->goal;
+  if(goal == 0)
+    goal = (ip->inum % ((sb.size + BPB - 1) / BPB)) * BPB;
+  if(goal >= sb.size)
+    goal = 0;
+
+  if(direct){
+    if((b = bscan(ip, goal, 1, 1)) == 0 && (b = bscan(ip, goal, 0, 1)) == 0){
+      log_waitinstall();
+      if((b = bscan(ip, goal, 0, 1)) == 0)
+        return 0;
+    }
+  } else {
+    if((b = bscan(ip, goal, 1, 0)) == 0 && (b = bscan(ip, goal, 0, 0)) == 0)
+      panic("balloc: out of blocks");
+    bzero(ip->dev, b);
+  }
+
+  ip->goal = b + 1;
+  resv_set(ip, b + 1);
+  return b;
+}
+
+static uint
+balloc(struct inode *ip, uint goal)
+{
+  return ballocd(ip, goal, 0);
 }
 
 // Inodes.
@@ -125,6 +296,8 @@ bfree(int dev, uint b)
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
 //   decrements ref.
+//*  Entries with ref zero keep their identity and contents
+//*  on an LRU list until iget() needs to recycle one.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
@@ -154,35 +327,144 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+//* The cache is a hash table on (dev, inum). Each hash bucket has a
+//* spin-lock that protects its chain and, for the inodes on it,
+//* ip->ref, ip->dev and ip->inum; one must hold the bucket lock
+//* while using any of those fields. Lookups of different inodes
+//* thus rarely contend. icache.lock protects only the LRU list of
+//* unreferenced inodes and the free list, and is taken inside a
+//* bucket lock, never the other way round.
+//* Entries are carved from kalloc'd pages as needed, up to NINODE;
+//* after that iget() recycles the least recently used unreferenced
+//* inode.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+#define NIHASH 61
 
-struct {
+struct ibucket {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;           //* chain through ip->hnext
+};
+
+struct {
+  struct ibucket bucket[NIHASH];
+  struct spinlock lock;         //* protects lru, free and n
+  struct inode lru;             //* lru.lnext is most recently used
+  struct inode *free;           //* unhashed entries, through hnext
+  int n;                        //* entries allocated so far
 } icache;
 
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &icache.bucket[(dev*31 + inum) % NIHASH];
+}
+
+// Caller holds icache.lock.
+static void
+lru_remove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext = ip->lprev = 0;
+}
+
+//* Put an unreferenced inode on the LRU list; inodes that were freed
+//* on disk go to the cold end to be recycled first.
+// Caller holds icache.lock.
+static void
+lru_insert(struct inode *ip, int hot)
+{
+  if(hot){
+    ip->lprev = &icache.lru;
+    ip->lnext = icache.lru.lnext;
+  } else {
+    ip->lnext = &icache.lru;
+    ip->lprev = icache.lru.lprev;
+  }
+  ip->lprev->lnext = ip;
+  ip->lnext->lprev = ip;
+}
+
+//* Return an unhashed entry for iget(): from the free list, from a
+//* newly allocated page, or by evicting the least recently used
+//* unreferenced inode.
+static struct inode*
+inewslot(void)
+{
+  struct inode *ip;
+  struct ibucket *b;
+  struct inode **pp;
+  char *page;
+  uint dev, inum;
+  int i;
+
+  for(;;){
+    acquire(&icache.lock);
+    if((ip = icache.free) != 0){
+      icache.free = ip->hnext;
+      release(&icache.lock);
+      return ip;
+    }
+    if(icache.n < NINODE && (page = kalloc()) != 0){
+      memset(page, 0, PGSIZE);
+      ip = (struct inode*)page;
+      for(i = 0; i < PGSIZE/sizeof(*ip) && icache.n < NINODE; i++, icache.n++){
+        initsleeplock(&ip[i].lock, "inode");
+        ip[i].hnext = icache.free;
+        icache.free = &ip[i];
+      }
+      release(&icache.lock);
+      continue;
+    }
+    ip = icache.lru.lprev;
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+    dev = ip->dev;
+    inum = ip->inum;
+    release(&icache.lock);
+
+    // Recheck under the victim's bucket lock: it may have been
+    // picked up again meanwhile.
+    b = ibucket(dev, inum);
+    acquire(&b->lock);
+    acquire(&icache.lock);
+    if(ip->ref == 0 && ip->lnext != 0 && ip->dev == dev && ip->inum == inum){
+      lru_remove(ip);
+      for(pp = &b->head; *pp != ip; pp = &(*pp)->hnext)
+        ;
+      *pp = ip->hnext;
+      release(&icache.lock);
+      release(&b->lock);
+      return ip;
+    }
+    release(&icache.lock);
+    release(&b->lock);
+  }
+}
+
 void
 iinit(int dev)
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  for(i = 0; i < NIHASH; i++)
+    initlock(&icache.bucket[i].lock, "ibucket");
+  icache.lru.lnext = icache.lru.lprev = &icache.lru;
+  initlock(&bmcache.lock, "bmcache");
+  initlock(&reclaim.lock, "reclaim");
+  dcache_init();
+  for(i = 0; i < NBMAP; i++)
+    bmcache.nfree[i] = -1;
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d features %x\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.features);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -204,6 +486,8 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if((sb.features & FSF_EXTENT) && (type == T_FILE || type == T_DIR))
+        dip->eh.magic = EXT_MAGIC;  //* empty extent tree root
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -230,7 +514,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->addrs, ip->addrs, IMAPSIZE);
   log_write(bp);
   brelse(bp);
 }
@@ -238,35 +522,63 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+//* Look in bucket b; caller holds b->lock.
+static struct inode*
+ifind(struct ibucket *b, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = b->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        acquire(&icache.lock);
+        lru_remove(ip);
+        release(&icache.lock);
+      }
+      return ip;
+    }
+  }
+  return 0;
+}
+
 static struct inode*
 iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
+  struct ibucket *b;
 
-  acquire(&icache.lock);
+  b = ibucket(dev, inum);
+  acquire(&b->lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  if((ip = ifind(b, dev, inum)) != 0){
+    release(&b->lock);
+    return ip;
   }
+  release(&b->lock);
 
   // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  empty = inewslot();
 
+  acquire(&b->lock);
+  if((ip = ifind(b, dev, inum)) != 0){
+    //* Someone else cached it meanwhile.
+    release(&b->lock);
+    acquire(&icache.lock);
+    empty->hnext = icache.free;
+    icache.free = empty;
+    release(&icache.lock);
+    return ip;
+  }
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  ip->goal = 0;
+  ip->hnext = b->head;
+  b->head = ip;
+  release(&b->lock);
 
   return ip;
 }
@@ -276,9 +588,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *b = ibucket(ip->dev, ip->inum);
+
+  acquire(&b->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&b->lock);
   return ip;
 }
 
@@ -303,7 +617,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->addrs, dip->addrs, IMAPSIZE);
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -328,17 +642,31 @@ iunlock(struct inode *ip)
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
+//* Freeing logs at most ITRUNC_INLINE blocks, which the caller's
+//* reservation must still hold: sys_unlink(), the largest such caller,
+//* has logged only the directory block and the two inodes by then.
 void
 iput(struct inode *ip)
 {
+  struct ibucket *b = ibucket(ip->dev, ip->inum);
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
-    acquire(&icache.lock);
+    acquire(&b->lock);
     int r = ip->ref;
-    release(&icache.lock);
+    release(&b->lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
-      itrunc(ip);
+      if(!itrunc(ip, ITRUNC_INLINE)){
+        //* Too big to free in one go; the reclaimer takes our reference.
+        releasesleep(&ip->lock);
+        reclaim_queue(ip);
+        return;
+      }
+      if(ip->type == T_DIR)
+        dcache_purge(ip->dev, ip->inum);
+      if(ip->type == T_FILE)
+        pcache_inval(ip->dev, ip->inum);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
@@ -346,9 +674,15 @@ iput(struct inode *ip)
   }
   releasesleep(&ip->lock);
 
-  acquire(&icache.lock);
+  acquire(&b->lock);
   ip->ref--;
-  release(&icache.lock);
+  if(ip->ref == 0){
+    resv_drop(ip);  //* nobody can append any more
+    acquire(&icache.lock);
+    lru_insert(ip, ip->valid);
+    release(&icache.lock);
+  }
+  release(&b->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -366,19 +700,202 @@ iunlockput(struct inode *ip)
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
+//* Extent-mapped inodes (FSF_EXTENT) keep an extent tree there instead;
+//* see the ext_*() helpers below.
+
+//* Index of the last entry in e[0..n) whose lblk <= bn, or -1.
+static int
+ext_find(struct extent *e, int n, uint bn)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = n - 1;
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    if(e[mid].lblk <= bn)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return hi;
+}
+
+//* Put extent ex to the right of everything in the subtree whose node
+//* (header eh, entries e) lives in bp, or in the inode if bp == 0.
+//* Returns 0 if it fit, otherwise the block of a new right sibling of this
+//* node (same depth) holding ex, which the caller must link into the parent.
+static uint
+ext_insert(struct inode *ip, struct exthdr *eh, struct extent *e,
+           int max, struct buf *bp, struct extent *ex)
+{
+  uint child, nb;
+  struct buf *cbp;
+  struct exthdr *neh;
+  struct extent link;
+
+  if(eh->depth == 0){
+    link = *ex;
+  } else {
+    child = e[eh->entries-1].start;
+    cbp = bread(ip->dev, child);
+    nb = ext_insert(ip, (struct exthdr*)cbp->data,
+                    (struct extent*)(cbp->data + sizeof(struct exthdr)),
+                    EXT_BLKMAX, cbp, ex);
+    brelse(cbp);
+    if(nb == 0)
+      return 0;
+    link.lblk = ex->lblk;
+    link.start = nb;
+    link.len = 0;
+  }
+
+  if(eh->entries < max){
+    e[eh->entries++] = link;
+    if(bp)
+      log_write(bp);
+    return 0;
+  }
+
+  //* This node is full: start a new one next to it.
+  nb = balloc(ip, 0);
+  cbp = bread(ip->dev, nb);
+  neh = (struct exthdr*)cbp->data;
+  neh->magic = EXT_MAGIC;
+  neh->depth = eh->depth;
+  neh->entries = 1;
+  *(struct extent*)(cbp->data + sizeof(struct exthdr)) = link;
+  log_write(cbp);
+  brelse(cbp);
+  return nb;
+}
+
+//* Append extent ex to the inode's extent tree, growing the tree
+//* by one level when the root in the inode overflows.
+static void
+ext_append(struct inode *ip, struct extent *ex)
+{
+  uint nb, old;
+  struct buf *bp;
+
+  nb = ext_insert(ip, &ip->eh, ip->ex, EXT_ROOTMAX, 0, ex);
+  if(nb == 0)
+    return;
+
+  if(ip->eh.depth + 1 > EXT_MAXDEPTH)
+    panic("ext_append: tree too deep");
+
+  //* Move the old root into a block and make the root an index
+  //* over it and its new sibling.
+  old = balloc(ip, 0);
+  bp = bread(ip->dev, old);
+  memmove(bp->data, &ip->eh, sizeof(ip->eh));
+  memmove(bp->data + sizeof(struct exthdr), ip->ex, sizeof(ip->ex));
+  log_write(bp);
+  brelse(bp);
+
+  ip->eh.depth++;
+  ip->eh.entries = 2;
+  ip->ex[1].lblk = ex->lblk;
+  ip->ex[1].start = nb;
+  ip->ex[1].len = 0;
+  ip->ex[0].start = old;
+  ip->ex[0].len = 0;
+}
+
+//* bmap() for extent-mapped inodes.
+//* Walk down to the leaf covering bn. If bn is not mapped, allocate a block
+//* right after the last extent so the file stays contiguous, and either
+//* grow that extent or append a new one.
+static uint
+ext_bmap(struct inode *ip, uint bn, int direct)
+{
+  int i, max;
+  uint addr;
+  struct buf *bp, *nbp;
+  struct exthdr *eh;
+  struct extent *e, ex;
+
+  bp = 0;
+  eh = &ip->eh;
+  e = ip->ex;
+  max = EXT_ROOTMAX;
+  while(eh->depth > 0){
+    if((i = ext_find(e, eh->entries, bn)) < 0)
+      panic("bmap: extent index");
+    nbp = bread(ip->dev, e[i].start);
+    if(bp)
+      brelse(bp);
+    bp = nbp;
+    eh = (struct exthdr*)bp->data;
+    e = (struct extent*)(bp->data + sizeof(struct exthdr));
+    max = EXT_BLKMAX;
+  }
+  if(eh->magic != EXT_MAGIC)
+    panic("bmap: bad extent");
+
+  i = ext_find(e, eh->entries, bn);
+  if(i >= 0 && bn < e[i].lblk + e[i].len){
+    addr = e[i].start + (bn - e[i].lblk);
+    if(bp)
+      brelse(bp);
+    return addr;
+  }
+
+  //* Not mapped. Files only grow at the end, so bn lies past the
+  //* last extent of the rightmost leaf.
+  if(i >= 0 && i == eh->entries - 1 && bn == e[i].lblk + e[i].len){
+    addr = ballocd(ip, e[i].start + e[i].len, direct);
+    if(addr == e[i].start + e[i].len){
+      e[i].len++;
+      if(bp){
+        log_write(bp);
+        brelse(bp);
+      }
+      return addr;
+    }
+  } else {
+    addr = ballocd(ip, i >= 0 ? e[i].start + e[i].len : 0, direct);
+  }
+  if(bp)
+    brelse(bp);
+  if(addr == 0)
+    return 0;  //* direct, and no block to write home
+
+  ex.lblk = bn;
+  ex.start = addr;
+  ex.len = 1;
+  if(max == EXT_ROOTMAX && eh->entries < max)
+    ip->ex[ip->eh.entries++] = ex;
+  else
+    ext_append(ip, &ex);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
+{
+  return bmapd(ip, bn, 0);
+}
+
+//* bmap() that allocates a missing data block with ballocd(direct).
+//* Index blocks are always zeroed through the log. Returns 0 if
+//* ballocd() found no data block.
+static uint
+bmapd(struct inode *ip, uint bn, int direct)
 {
   uint addr, *a;
   uint f_addr, s_addr, t_addr; //* addr indicator of first layer and second layer
   struct buf *bp;
 
+  if(ip->eh.magic == EXT_MAGIC)
+    return ext_bmap(ip, bn, direct);
+
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = ballocd(ip, 0, direct);
     return addr;
   }
   bn -= NDIRECT;
@@ -387,11 +904,11 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = ballocd(ip, 0, direct);
       log_write(bp);
     }
     brelse(bp);
@@ -405,7 +922,7 @@ bmap(struct inode *ip, uint bn)
     //* Step 1) Check the first indirect layer.
     if((addr = ip->D_addr) == 0){
       //* Not initalized; Allocation Required.
-      ip->D_addr = addr = balloc(ip->dev);
+      ip->D_addr = addr = balloc(ip, 0);
     }
 
     //* Step 2) Enter first layer.
@@ -421,7 +938,7 @@ bmap(struct inode *ip, uint bn)
     f_addr = bn / LAYERLIMIT;
     if((addr = a[f_addr]) == 0){
       //* Allocate if necessary
-      a[f_addr] = addr = balloc(ip->dev);
+      a[f_addr] = addr = balloc(ip, 0);
       log_write(bp);
     }
     brelse(bp);
@@ -439,7 +956,7 @@ bmap(struct inode *ip, uint bn)
     s_addr = bn % LAYERLIMIT;
     if((addr = a[s_addr]) == 0){
       //* Allocate if necessary
-      a[s_addr] = addr = balloc(ip->dev);
+      a[s_addr] = addr = ballocd(ip, 0, direct);
       log_write(bp);
     }
     brelse(bp);
@@ -455,7 +972,7 @@ bmap(struct inode *ip, uint bn)
     //* It will be the same logic with double indrect but more layers.
     if((addr = ip->T_addr) == 0){
       //* Not initalized; Allocation Required.
-      ip->T_addr = addr = balloc(ip->dev);
+      ip->T_addr = addr = balloc(ip, 0);
     }
 
     //* Step 2) Enter first layer.
@@ -471,7 +988,7 @@ bmap(struct inode *ip, uint bn)
     f_addr = bn / LARGELAYERLIMIT;
     if((addr = a[f_addr]) == 0){
       //* Allocate if necessary
-      a[f_addr] = addr = balloc(ip->dev);
+      a[f_addr] = addr = balloc(ip, 0);
       log_write(bp);
     }
     brelse(bp);
@@ -489,7 +1006,7 @@ bmap(struct inode *ip, uint bn)
     s_addr = (bn % LARGELAYERLIMIT)/LAYERLIMIT;
     if((addr = a[s_addr]) == 0){
       //* Allocate if necessary
-      a[s_addr] = addr = balloc(ip->dev);
+      a[s_addr] = addr = balloc(ip, 0);
       log_write(bp);
     }
     brelse(bp);
@@ -507,7 +1024,7 @@ bmap(struct inode *ip, uint bn)
     t_addr = (bn % LARGELAYERLIMIT) % LAYERLIMIT;
     if((addr = a[t_addr]) == 0){
       //* Allocate if necessary
-      a[t_addr] = addr = balloc(ip->dev);
+      a[t_addr] = addr = ballocd(ip, 0, direct);
       log_write(bp);
     }
     brelse(bp);
@@ -520,39 +1037,293 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+//* Batched block freeing for truncation.
+//* Frees are queued and applied one bitmap block at a time, so freeing a
+//* run of blocks costs one bread/log_write per bitmap block instead of one
+//* per block. The batch also caps how many distinct bitmap blocks one
+//* transaction may dirty: bqueue() refuses a block once that budget is
+//* spent, and the truncation stops there and goes on in a later transaction.
+#define NBATCH 64
+
+struct bbatch {
+  uint dev;
+  int budget;               //* max distinct bitmap blocks
+  int nbm;
+  uint bm[MAXOPBLOCKS];     //* bitmap blocks dirtied so far
+  int n;
+  uint b[NBATCH];           //* queued blocks
+};
+
+//* Clear the bits of every queued block.
+static void
+bflush(struct bbatch *fb)
+{
+  int i, j, bi, m, g;
+  struct buf *bp;
+
+  for(j = 0; j < fb->nbm; j++){
+    bp = 0;
+    for(i = 0; i < fb->n; i++){
+      if(BBLOCK(fb->b[i], sb) != fb->bm[j])
+        continue;
+      if(bp == 0)
+        bp = bread(fb->dev, fb->bm[j]);
+      bi = fb->b[i] % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      log_free(fb->b[i]);
+      g = fb->b[i] / BPB;
+      if(g < NBMAP && bmcache.nfree[g] >= 0){
+        bmcache.nfree[g]++;
+        if(bi < bmcache.hint[g])
+          bmcache.hint[g] = bi;
+      }
+    }
+    if(bp){
+      log_write(bp);
+      brelse(bp);
+    }
+  }
+  fb->n = 0;
+}
+
+//* Queue block b to be freed. Returns -1 if that would dirty one
+//* bitmap block more than the budget allows.
+static int
+bqueue(struct bbatch *fb, uint b)
+{
+  int j;
+
+  for(j = 0; j < fb->nbm; j++)
+    if(fb->bm[j] == BBLOCK(b, sb))
+      break;
+  if(j == fb->nbm){
+    if(fb->nbm >= fb->budget)
+      return -1;
+    fb->bm[fb->nbm++] = BBLOCK(b, sb);
+  }
+  if(fb->n == NBATCH)
+    bflush(fb);
+  fb->b[fb->n++] = b;
+  return 0;
+}
+
+//* Free the indirect tree of height h (0: a single data block) rooted at
+//* block addr, last blocks first. Returns 1 if all of it was freed.
+//* Otherwise the budget ran out; the pointers to what was freed have been
+//* zeroed and logged, so the tree on disk never names a free block.
+static int
+trunc_tree(struct bbatch *fb, uint addr, int h)
+{
+  int i, dirty;
+  uint *a;
+  struct buf *bp;
+
+  if(h == 0)
+    return bqueue(fb, addr) == 0;
+
+  bp = bread(fb->dev, addr);
+  a = (uint*)bp->data;
+  dirty = 0;
+  for(i = NINDIRECT-1; i >= 0; i--){
+    if(a[i] == 0)
+      continue;
+    if(!trunc_tree(fb, a[i], h-1))
+      break;
+    a[i] = 0;
+    dirty = 1;
+  }
+  if(i < 0 && bqueue(fb, addr) == 0){
+    brelse(bp);  //* freed, so its zeroed contents need not be logged
+    return 1;
+  }
+  if(dirty)
+    log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+//* trunc_tree() for the extent node (eh, e). Returns 1 once the node is
+//* empty; the caller frees the node's own block and logs or updates it.
+static int
+ext_trunc(struct bbatch *fb, struct exthdr *eh, struct extent *e)
+{
+  struct extent *x;
+  struct buf *bp;
+
+  while(eh->entries > 0){
+    x = &e[eh->entries-1];
+    if(eh->depth == 0){
+      while(x->len > 0 && bqueue(fb, x->start + x->len - 1) == 0)
+        x->len--;
+      if(x->len > 0)
+        return 0;
+    } else {
+      bp = bread(fb->dev, x->start);
+      if(!ext_trunc(fb, (struct exthdr*)bp->data,
+                    (struct extent*)(bp->data + sizeof(struct exthdr))) ||
+         bqueue(fb, x->start) != 0){
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+      brelse(bp);
+    }
+    eh->entries--;
+  }
+  return 1;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
-static void
-itrunc(struct inode *ip)
+//* Frees as much as budget log blocks allow within the current
+//* transaction, last blocks first, and returns 1 once nothing is left.
+//* ITRUNC_META of the budget is kept for index blocks and the inode;
+//* the rest caps the bitmap blocks.
+//* The inode on disk stays consistent in between, so a big file can be
+//* freed over several transactions (see ireclaim()).
+static int
+itrunc(struct inode *ip, int budget)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  int i, done;
+  struct bbatch fb;
+
+  if(budget <= ITRUNC_META)
+    panic("itrunc: budget");
+  fb.dev = ip->dev;
+  fb.budget = budget - ITRUNC_META;
+  fb.nbm = 0;
+  fb.n = 0;
+  done = 1;
+
+  if(ip->type == T_SBLK && ip->major == SYM_INLINE){
+    //* Nothing but the target in the block map.
+    memset(ip->addrs, 0, IMAPSIZE);
+  } else if(ip->eh.magic == EXT_MAGIC){
+    if((done = ext_trunc(&fb, &ip->eh, ip->ex)) != 0)
+      ip->eh.depth = 0;
+  } else {
+    if(ip->T_addr && (done = trunc_tree(&fb, ip->T_addr, 3)) != 0)
+      ip->T_addr = 0;
+    if(done && ip->D_addr && (done = trunc_tree(&fb, ip->D_addr, 2)) != 0)
+      ip->D_addr = 0;
+    if(done && ip->addrs[NDIRECT] &&
+       (done = trunc_tree(&fb, ip->addrs[NDIRECT], 1)) != 0)
+      ip->addrs[NDIRECT] = 0;
+    for(i = NDIRECT-1; i >= 0 && done; i--){
+      if(ip->addrs[i] && (done = trunc_tree(&fb, ip->addrs[i], 0)) != 0)
+        ip->addrs[i] = 0;
     }
   }
+  bflush(&fb);
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  if(done)
+    ip->size = 0;
+  iupdate(ip);
+  return done;
+}
+
+//* Background reclaimer.
+//* iput() frees only what fits in its caller's transaction and queues
+//* the rest here; ireclaim() runs as a kernel process and finishes the
+//* job in transactions of its own. Each queued inode keeps the reference
+//* iput() was dropping, so the queue never outgrows the inode cache.
+static void
+reclaim_queue(struct inode *ip)
+{
+  acquire(&reclaim.lock);
+  if(reclaim.n == NINODE)
+    panic("reclaim_queue");
+  reclaim.q[reclaim.n++] = ip;
+  wakeup(&reclaim);
+  release(&reclaim.lock);
+}
+
+//* Finish freeing ip, which has no links, in transactions of its own,
+//* then drop the caller's reference.
+static void
+ifree(struct inode *ip)
+{
+  int done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    if((done = itrunc(ip, ITRUNC_STEP)) != 0){
+      if(ip->type == T_DIR)
+        dcache_purge(ip->dev, ip->inum);
+      if(ip->type == T_FILE)
+        pcache_inval(ip->dev, ip->inum);
+      ip->type = 0;
+      iupdate(ip);
+      ip->valid = 0;
     }
+    iunlock(ip);
+    end_op();
+  } while(!done);
+
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+//* Free the files that were unlinked while open when the system went
+//* down: still allocated with no links, and nobody can reach them.
+//* Runs from forkret() once logd is up and before the first process
+//* returns to user space, since a file being created (ialloc() before
+//* the link) or unlinked while open looks just the same. Each orphan
+//* is freed before the next is looked for, so any number is fine.
+void
+iorphans(int dev)
+{
+  uint inum;
+  int orphan, ref;
+  struct buf *bp;
+  struct dinode *dip;
+  struct ibucket *b;
+  struct inode *ip;
+
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    orphan = dip->type != 0 && dip->nlink == 0;
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    if(!orphan)
+      continue;
+    ip = iget(dev, inum);
+    b = ibucket(dev, inum);
+    acquire(&b->lock);
+    ref = ip->ref;
+    release(&b->lock);
+    if(ref > 1){
+      //* Somebody holds it; their iput() frees it.
+      begin_op();
+      iput(ip);
+      end_op();
+      continue;
+    }
+    ifree(ip);
   }
+}
 
-  ip->size = 0;
-  iupdate(ip);
+void
+ireclaim(void)
+{
+  struct inode *ip;
+
+  for(;;){
+    acquire(&reclaim.lock);
+    while(reclaim.n == 0)
+      sleep(&reclaim, &reclaim.lock);
+    ip = reclaim.q[--reclaim.n];
+    release(&reclaim.lock);
+    ifree(ip);
+  }
 }
 
 // Copy stat information from inode.
@@ -587,9 +1358,16 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_SBLK && ip->major == SYM_INLINE){
+    memmove(dst, (char*)ip->addrs + off, n);
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->type == T_FILE && pcache_read(ip, dst, off, m))
+      continue;  //* cached page may be newer (shared mapping)
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
@@ -602,7 +1380,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, fresh, addr;
+  int inplace;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -611,18 +1390,54 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
+  if(ip->type == T_SBLK && ip->major == SYM_INLINE)
+    return -1;  //* see symwrite()
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  //* In ordered mode (FSF_ORDERED) file data goes straight home, ahead
+  //* of the commit that logs the inode and bitmap changes pointing at
+  //* it. Blocks past the old end of the file are new and are not read.
+  //* A data block the log holds (it was logged before it became file
+  //* data) stays logged, so the install cannot overwrite the new data.
+  inplace = ip->type == T_FILE && (sb.features & FSF_ORDERED);
+  fresh = (ip->size + BSIZE - 1) / BSIZE;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(inplace && off/BSIZE >= fresh){
+      if((addr = bmapd(ip, off/BSIZE, 1)) == 0){
+        n = tot;  //* disk full: a short write
+        break;
+      }
+      if(log_reusable(addr)){
+        bp = bclaim(ip->dev, addr);
+        memmove(bp->data + off%BSIZE, src, m);
+        bwrite(bp);
+        brelse(bp);
+        continue;
+      }
+    } else {
+      addr = bmap(ip, off/BSIZE);
+    }
+    bp = bread(ip->dev, addr);
+    if(inplace && (bp->flags & B_DIRTY)){
+      //* Once the committed transaction is installed, a logged block
+      //* can only be in the open one, which absorbs this write.
+      brelse(bp);
+      log_waitinstall();
+      bp = bread(ip->dev, addr);
+    }
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(inplace && !(bp->flags & B_DIRTY))
+      bwrite(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
+  if(ip->type == T_FILE)
+    pcache_write(ip, src - n, off - n, n);
 
   if(n > 0 && off > ip->size){
     ip->size = off;
@@ -631,6 +1446,26 @@ writei(struct inode *ip, char *src, uint off, uint n)
   return n;
 }
 
+//* Upper bound on the log blocks writei(ip, off, n) dirties: every
+//* block it logs, plus the inode, the bitmap blocks and the index
+//* blocks new data blocks need. In ordered mode file data costs nothing:
+//* new blocks are written home (see ballocd()), old ones stay logged
+//* only if they already are.
+int
+writecost(struct inode *ip, uint off, uint n)
+{
+  uint nb, logged;
+
+  if(n == 0)
+    return 0;
+  nb = (off + n - 1) / BSIZE - off / BSIZE + 1;
+  logged = nb;
+  if(ip->type == T_FILE && (sb.features & FSF_ORDERED))
+    logged = 0;
+  return logged + 1 + (nb / BPB + 2) +
+    (nb / (ip->eh.magic == EXT_MAGIC ? EXT_BLKMAX : NINDIRECT) + EXT_MAXDEPTH);
+}
+
 //PAGEBREAK!
 // Directories
 
@@ -640,6 +1475,484 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+//* Directory name lookup cache.
+//* Maps (dev, directory inum, name) to the entry's inum and offset, or
+//* remembers that the name is absent (inum 0), so resolving a path seen
+//* before reads no directory blocks. Entries are kept on hash chains
+//* and an LRU list, like bcache. Directory contents only change under
+//* the directory's sleeplock, through dirlink() and dcache_drop(), so
+//* callers holding dp->lock see a consistent cache; dcache.lock only
+//* guards the table itself.
+#define NDCACHE 128
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;            //* directory holding the name
+  uint inum;             //* 0: name known to be absent
+  uint off;              //* byte offset of the dirent in the directory
+  char name[DIRSIZ];
+  struct dentry *hnext;  //* hash chain
+  struct dentry *prev;   //* LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  struct dentry head;    //* head.next is most recently used
+} dcache;
+
+static void
+dcache_init(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dinum, d->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+//* Move d to the front (used) or back (free) of the LRU list.
+static void
+dtouch(struct dentry *d, int front)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(front){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+  } else {
+    d->next = &dcache.head;
+    d->prev = dcache.head.prev;
+  }
+  d->prev->next = d;
+  d->next->prev = d;
+}
+
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dinum, name); d; d = d->hnext)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+//* Record that name in dp is inum at off (inum 0: absent).
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **hp;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.head.prev;  //* least recently used
+    if(d->dinum)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    hp = dhash(d->dev, d->dinum, d->name);
+    d->hnext = *hp;
+    *hp = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d, 1);
+  release(&dcache.lock);
+}
+
+// Forget name in dp; called when its dirent is cleared.
+// Caller must hold dp->lock.
+void
+dcache_drop(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    dunhash(d);
+    dtouch(d, 0);
+  }
+  release(&dcache.lock);
+}
+
+//* Forget everything cached under a directory that is being freed,
+//* before its inode number can be reused.
+static void
+dcache_purge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    if(d->dinum == dinum && d->dev == dev){
+      dunhash(d);
+      dtouch(d, 0);
+    }
+  }
+  release(&dcache.lock);
+}
+
+//* Hash-indexed directories; the layout is described in fs.h.
+//* A one-block directory is converted when it first needs a second
+//* block. Full leaves split at a hash boundary, full index blocks split
+//* in half, and a full root moves into a new index block one level down.
+//* A directory never grows inside the transaction that adds a name:
+//* the caller checks dirfull() first and has dirgrow() make room in
+//* transactions of its own, one dx_grow() or dx_convert() each
+//* (DXGROWBLOCKS).
+
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;  //* FNV-1a
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static struct dxhead*
+dxhd(struct buf *bp, uint lblk)
+{
+  return (struct dxhead*)bp->data + (lblk == 0 ? DX_ROOTSLOT : 0);
+}
+
+static int
+dxlimit(uint lblk)
+{
+  return lblk == 0 ? DPB - DX_ROOTSLOT - 1 : DPB - 1;
+}
+
+//* Is dp hash-indexed? Caller must hold dp->lock.
+static int
+dxindexed(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxhead *h;
+  int r;
+
+  if(dp->size < BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  h = dxhd(bp, 0);
+  r = h->inum == 0 && h->magic == DX_MAGIC;
+  brelse(bp);
+  return r;
+}
+
+//* Append a zeroed block to dp; returns it locked, its number in *lblk.
+static struct buf*
+dxnewblock(struct inode *dp, uint *lblk)
+{
+  struct buf *bp;
+
+  *lblk = dp->size / BSIZE;
+  bp = bread(dp->dev, bmap(dp, *lblk));
+  memset(bp->data, 0, BSIZE);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bp;
+}
+
+//* Walk the index to the leaf covering hash h, recording the index
+//* blocks in path[0..depth] and the entry taken in each in idx[].
+//* Returns the leaf's block number; *pdepth gets the root depth.
+static uint
+dxwalk(struct inode *dp, uint h, uint *path, int *idx, int *pdepth)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint lblk;
+  int lv, depth, lo, hi, mid;
+
+  lblk = 0;
+  depth = 0;
+  for(lv = 0; lv <= depth; lv++){
+    bp = bread(dp->dev, bmap(dp, lblk));
+    hd = dxhd(bp, lblk);
+    if(hd->magic != DX_MAGIC || hd->count == 0)
+      panic("dxwalk");
+    if(lv == 0)
+      depth = hd->depth;
+    e = (struct dxentry*)(hd + 1);
+    // last entry with e[i].hash <= h
+    lo = 0;
+    hi = hd->count - 1;
+    while(lo < hi){
+      mid = (lo + hi + 1) / 2;
+      if(e[mid].hash <= h)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    path[lv] = lblk;
+    idx[lv] = lo;
+    lblk = e[lo].blk;
+    brelse(bp);
+  }
+  *pdepth = depth;
+  return lblk;
+}
+
+static uint
+dx_lookup(struct inode *dp, char *name, uint *poff)
+{
+  uint path[DX_MAXDEPTH+1], leaf, inum;
+  int idx[DX_MAXDEPTH+1], depth, i;
+  struct buf *bp;
+  struct dirent *de;
+
+  leaf = dxwalk(dp, dxhash(name), path, idx, &depth);
+  bp = bread(dp->dev, bmap(dp, leaf));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = leaf*BSIZE + i*sizeof(*de);
+      brelse(bp);
+      return inum;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+//* Insert (hash, blk) after entry pos of index block lblk,
+//* which must have room.
+static void
+dxaddentry(struct inode *dp, uint lblk, int pos, uint hash, uint blk)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, lblk));
+  hd = dxhd(bp, lblk);
+  e = (struct dxentry*)(hd + 1);
+  for(i = hd->count; i > pos + 1; i--)
+    e[i] = e[i-1];
+  memset(&e[pos+1], 0, sizeof(*e));
+  e[pos+1].hash = hash;
+  e[pos+1].blk = blk;
+  hd->count++;
+  log_write(bp);
+  brelse(bp);
+}
+
+//* Make room below the leaf dxwalk() found for hash h: split the leaf
+//* if its parent has room, otherwise split the lowest full index block
+//* whose parent has room, or deepen the root. It may take several calls
+//* before the leaf has room. Returns -1 if the directory cannot grow
+//* any further.
+static int
+dx_grow(struct inode *dp, uint h)
+{
+  uint path[DX_MAXDEPTH+1], hs[DPB], leaf, nblk, split, t;
+  int idx[DX_MAXDEPTH+1], depth, lv, i, j, n;
+  struct buf *bp, *nbp;
+  struct dxhead *hd, *nhd;
+  struct dxentry *e, *ne;
+  struct dirent *de, *nde;
+
+  leaf = dxwalk(dp, h, path, idx, &depth);
+
+  // Find the lowest index block on the path that has room.
+  for(lv = depth; lv >= 0; lv--){
+    bp = bread(dp->dev, bmap(dp, path[lv]));
+    n = dxhd(bp, path[lv])->count;
+    brelse(bp);
+    if(n < dxlimit(path[lv]))
+      break;
+  }
+
+  if(lv < 0){
+    // Root is full: push its entries down into a new index block.
+    if(depth == DX_MAXDEPTH)
+      return -1;
+    nbp = dxnewblock(dp, &nblk);
+    bp = bread(dp->dev, bmap(dp, 0));
+    hd = dxhd(bp, 0);
+    nhd = dxhd(nbp, nblk);
+    nhd->magic = DX_MAGIC;
+    nhd->count = hd->count;
+    memmove(nhd + 1, hd + 1, hd->count * sizeof(struct dxentry));
+    e = (struct dxentry*)(hd + 1);
+    memset(e, 0, hd->count * sizeof(*e));
+    e[0].blk = nblk;
+    hd->count = 1;
+    hd->depth++;
+    log_write(nbp);
+    log_write(bp);
+    brelse(nbp);
+    brelse(bp);
+    return 0;
+  }
+
+  if(lv < depth){
+    // path[lv+1] is a full index block: move its upper half to a new one.
+    nbp = dxnewblock(dp, &nblk);
+    bp = bread(dp->dev, bmap(dp, path[lv+1]));
+    hd = dxhd(bp, path[lv+1]);
+    nhd = dxhd(nbp, nblk);
+    e = (struct dxentry*)(hd + 1);
+    ne = (struct dxentry*)(nhd + 1);
+    n = hd->count / 2;
+    nhd->magic = DX_MAGIC;
+    nhd->count = hd->count - n;
+    memmove(ne, &e[n], nhd->count * sizeof(*e));
+    memset(&e[n], 0, nhd->count * sizeof(*e));
+    hd->count = n;
+    split = ne[0].hash;
+    log_write(nbp);
+    log_write(bp);
+    brelse(nbp);
+    brelse(bp);
+    dxaddentry(dp, path[lv], idx[lv], split, nblk);
+    return 0;
+  }
+
+  // The leaf's parent has room: split the leaf at a hash boundary
+  // near the median, so equal hashes stay in one leaf.
+  bp = bread(dp->dev, bmap(dp, leaf));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    t = dxhash(de[i].name);
+    for(j = i; j > 0 && hs[j-1] > t; j--)
+      hs[j] = hs[j-1];
+    hs[j] = t;
+  }
+  for(i = 0; i < DPB/2; i++){
+    if(hs[DPB/2 + i] != hs[DPB/2 + i - 1]){
+      split = hs[DPB/2 + i];
+      break;
+    }
+    if(hs[DPB/2 - i] != hs[DPB/2 - i - 1]){
+      split = hs[DPB/2 - i];
+      break;
+    }
+  }
+  if(i == DPB/2){
+    brelse(bp);
+    return -1;
+  }
+  nbp = dxnewblock(dp, &nblk);
+  nde = (struct dirent*)nbp->data;
+  for(i = j = 0; i < DPB; i++){
+    if(dxhash(de[i].name) >= split){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nbp);
+  log_write(bp);
+  brelse(nbp);
+  brelse(bp);
+  dxaddentry(dp, path[depth], idx[depth], split, nblk);
+  dcache_purge(dp->dev, dp->inum);  //* entries moved
+  return 0;
+}
+
+//* Turn the full one-block directory dp into an indexed one
+//* with a single leaf.
+static void
+dx_convert(struct inode *dp)
+{
+  struct buf *bp, *lbp;
+  struct dirent *de;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint leaf;
+
+  lbp = dxnewblock(dp, &leaf);
+  bp = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)bp->data;
+  memmove(lbp->data, &de[DX_ROOTSLOT], (DPB - DX_ROOTSLOT) * sizeof(*de));
+  memset(&de[DX_ROOTSLOT], 0, (DPB - DX_ROOTSLOT) * sizeof(*de));
+  hd = dxhd(bp, 0);
+  hd->magic = DX_MAGIC;
+  hd->count = 1;
+  e = (struct dxentry*)(hd + 1);
+  e[0].blk = leaf;
+  log_write(lbp);
+  log_write(bp);
+  brelse(lbp);
+  brelse(bp);
+  dcache_purge(dp->dev, dp->inum);
+}
+
+//* Add (name, inum) to the indexed directory dp; with dryrun set,
+//* only look for a free slot. Returns the entry's offset, or -1 if
+//* name's leaf is full.
+static int
+dx_link(struct inode *dp, char *name, uint inum, int dryrun)
+{
+  uint path[DX_MAXDEPTH+1], leaf, off;
+  int idx[DX_MAXDEPTH+1], depth, i;
+  struct buf *bp;
+  struct dirent *de;
+
+  leaf = dxwalk(dp, dxhash(name), path, idx, &depth);
+  bp = bread(dp->dev, bmap(dp, leaf));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum == 0){
+      if(!dryrun){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+      }
+      brelse(bp);
+      off = leaf*BSIZE + i*sizeof(*de);
+      return off;
+    }
+  }
+  brelse(bp);
+  return -1;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -647,10 +1960,36 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    dtouch(d, 1);
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  if(dxindexed(dp)){
+    if((inum = dx_lookup(dp, name, &off)) == 0){
+      dcache_enter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcache_enter(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -661,10 +2000,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcache_enter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcache_enter(dp, name, 0, 0);
   return 0;
 }
 
@@ -682,6 +2023,13 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dxindexed(dp)){
+    if((off = dx_link(dp, name, inum, 0)) < 0)
+      return -1;
+    dcache_enter(dp, name, inum, off);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
@@ -690,14 +2038,65 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  //* A full one-block directory gets an index instead of a second
+  //* flat block, from dirgrow().
+  if(off == BSIZE && dp->size == BSIZE && (sb.features & FSF_HDIR))
+    return -1;
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
 
+//* Would dirlink(dp, name) have to grow dp's hash index, or give dp
+//* one, first? Then the caller must let dirgrow() make room before it
+//* links name. Caller must hold dp->lock.
+int
+dirfull(struct inode *dp, char *name)
+{
+  uint off;
+  struct dirent de;
+
+  if(dxindexed(dp))
+    return dx_link(dp, name, 0, 1) < 0;
+  if(dp->size != BSIZE || !(sb.features & FSF_HDIR))
+    return 0;
+  for(off = 0; off < BSIZE; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirfull read");
+    if(de.inum == 0)
+      return 0;
+  }
+  return 1;
+}
+
+//* Make room for name in dp, which dirfull() said had none, by one
+//* dx_convert() or dx_grow() step in a transaction of its own. The
+//* caller holds a reference to dp but no lock and no transaction, and
+//* checks dirfull() again. Returns -1 if dp cannot grow any further.
+int
+dirgrow(struct inode *dp, char *name)
+{
+  int r;
+
+  r = 0;
+  begin_opn(DXGROWBLOCKS);
+  ilock(dp);
+  if(dirfull(dp, name)){
+    if(dxindexed(dp))
+      r = dx_grow(dp, dxhash(name));
+    else
+      dx_convert(dp);
+  }
+  iunlock(dp);
+  end_opn(DXGROWBLOCKS);
+  return r;
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -738,20 +2137,74 @@ skipelem(char *path, char *name)
   return path;
 }
 
+//* Store target as the content of the new symbolic link ip.
+//* Short targets go in the inode itself (see SYM_INLINE in fs.h).
+// Caller must hold ip->lock.
+int
+symwrite(struct inode *ip, char *target)
+{
+  int length;
+
+  length = strlen(target);
+  if(length < IMAPSIZE){
+    memset(ip->addrs, 0, IMAPSIZE);
+    memmove(ip->addrs, target, length + 1);
+    ip->major = SYM_INLINE;
+    ip->size = length;
+    iupdate(ip);
+    return 0;
+  }
+  if(writei(ip, (char*)&length, 0, sizeof(int)) != sizeof(int) ||
+     writei(ip, target, sizeof(int), length + 1) != length + 1)
+    return -1;
+  iupdate(ip);
+  return 0;
+}
+
+//* Copy the target of symbolic link ip into buf.
+//* Returns its length, or -1 if it does not fit in n bytes.
+// Caller must hold ip->lock.
+static int
+symread(struct inode *ip, char *buf, int n)
+{
+  int length;
+
+  if(ip->major == SYM_INLINE){
+    if(ip->size >= n)
+      return -1;
+    memmove(buf, ip->addrs, ip->size);
+    buf[ip->size] = 0;
+    return ip->size;
+  }
+  if(readi(ip, (char*)&length, 0, sizeof(int)) != sizeof(int) ||
+     length < 0 || length >= n ||
+     readi(ip, buf, sizeof(int), length) != length)
+    return -1;
+  buf[length] = 0;
+  return length;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
+//* Symbolic links met along the way are followed, and so is one in
+//* the final element if follow is set. A link's target is resolved
+//* relative to the directory holding it. At most MAXSYMLINKS are
+//* followed, so a cycle of links fails instead of looping.
 static struct inode*
-namex(char *path, int nameiparent, char *name)
+namex(char *path, int nameiparent, char *name, int follow)
 {
   struct inode *ip, *next;
+  char buf[MAXPATH], target[MAXPATH];
+  int hops, n;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
     ip = idup(myproc()->cwd);
 
+  hops = 0;
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
     if(ip->type != T_DIR){
@@ -767,7 +2220,38 @@ namex(char *path, int nameiparent, char *name)
       iunlockput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlock(ip);
+    if(*path != '\0' || follow){
+      ilock(next);
+      if(next->type == T_SBLK){
+        //* Continue with target + "/" + rest of the path.
+        n = -1;
+        if(++hops <= MAXSYMLINKS)
+          n = symread(next, target, MAXPATH);
+        iunlockput(next);
+        if(n > 0 && *path != '\0'){
+          if(n + 1 + strlen(path) >= MAXPATH)
+            n = -1;
+          else {
+            target[n++] = '/';
+            safestrcpy(target + n, path, MAXPATH - n);
+          }
+        }
+        if(n <= 0){
+          iput(ip);
+          return 0;
+        }
+        safestrcpy(buf, target, MAXPATH);
+        path = buf;
+        if(*path == '/'){
+          iput(ip);
+          ip = iget(ROOTDEV, ROOTINO);
+        }
+        continue;
+      }
+      iunlock(next);
+    }
+    iput(ip);
     ip = next;
   }
   if(nameiparent){
@@ -777,17 +2261,24 @@ namex(char *path, int nameiparent, char *name)
   return ip;
 }
 
-
-
 struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return namex(path, 0, name, 1);
+}
+
+//* Same as namei, but does not follow a symbolic link in the final
+//* path element.
+struct inode*
+nameinf(char *path)
+{
+  char name[DIRSIZ];
+  return namex(path, 0, name, 0);
 }
 
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return namex(path, 1, name, 0);
 }
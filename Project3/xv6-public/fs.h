@@ -19,6 +19,34 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint features;     //* Optional on-disk format features (FSF_*)
+};
+
+//* Superblock feature flags.
+#define FSF_EXTENT 0x1  //* New files and directories are extent-mapped
+#define FSF_HDIR   0x2  //* Directories outgrowing a block get a hash index
+#define FSF_ORDERED 0x4 //* Ordered journaling: file data is written in place,
+                        //* only metadata goes through the log
+
+//* On-disk log (sb.nlog blocks, sized by mkfs):
+//*   [ header | descriptor blocks | logged blocks ]
+//* The header doubles as the commit record. It is written last and names
+//* the first LOGHDRN home block numbers; descriptor blocks hold the rest.
+//* A transaction counts as committed only if csum matches a CRC-32 of
+//* seq, n, the block numbers and the logged blocks, so a single header
+//* write commits it and the log is never cleared afterwards.
+#define LOGMAGIC 0x10c5a7e1
+#define LOGHDRN ((BSIZE - 4*sizeof(uint)) / sizeof(uint))
+#define LOGDESCN (BSIZE / sizeof(uint))
+#define LOGNDESC(n) ((n) <= LOGHDRN ? 0 : ((n) - LOGHDRN + LOGDESCN - 1) / LOGDESCN)
+#define LOGBLOCKS(n) (1 + LOGNDESC(n) + (n))  //* log area holding n blocks
+
+struct dloghdr {
+  uint magic;           //* LOGMAGIC
+  uint seq;             //* commit sequence number
+  uint n;               //* number of logged blocks
+  uint csum;            //* CRC-32 of the whole transaction
+  uint block[LOGHDRN];  //* home block numbers
 };
 
 #define NDIRECT 10 //* Reduced NDIRECT num
@@ -33,6 +61,42 @@ struct superblock {
 #define LAYERLIMIT 128
 #define LARGELAYERLIMIT 16384
 
+//* Extent-mapped inodes.
+//* An extent maps a run of len logical blocks starting at lblk
+//* onto contiguous disk blocks starting at start.
+//* Extents form a tree: the root lives in the inode itself, in place of
+//* addrs/D_addr/T_addr, and deeper nodes live in whole disk blocks.
+//* Every node begins with an exthdr; in index nodes (depth > 0) an entry's
+//* start is the block number of the child node and len is unused.
+//* The magic number sits in the high half of the first word, so that word
+//* can never be a valid addrs[0] (block number); this is how bmap() and
+//* itrunc() tell the two inode flavors apart.
+#define EXT_MAGIC 0xE47E
+#define EXT_ROOTMAX 4   //* extents held in the inode itself
+#define EXT_BLKMAX ((BSIZE - sizeof(struct exthdr)) / sizeof(struct extent))
+#define EXT_MAXDEPTH 4
+
+struct exthdr {
+  uchar entries;        //* Number of valid entries in this node
+  uchar depth;          //* 0 for leaf nodes
+  ushort magic;         //* EXT_MAGIC
+};
+
+struct extent {
+  uint lblk;            //* First logical block covered
+  uint start;           //* First disk block (child node if index)
+  uint len;             //* Number of blocks (leaf only)
+};
+
+//* Bytes of block mapping kept in the inode (both flavors).
+#define IMAPSIZE ((NDIRECT+3) * sizeof(uint))
+
+//* A symbolic link (T_SBLK) whose target is shorter than IMAPSIZE keeps
+//* it, NUL-terminated, in the block map area and has no data blocks;
+//* such "fast" links are marked with major == SYM_INLINE. Longer
+//* targets are stored in the data as [int length][path].
+#define SYM_INLINE 1
+
 // On-disk inode structure
 struct dinode {
   short type;           // File type
@@ -40,9 +104,17 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
-  uint D_addr;		  //* Double Indirect
-  uint T_addr;		 //* Triple Indirect
+  union {
+    struct {
+      uint addrs[NDIRECT+1];   // Data block addresses
+      uint D_addr;		  //* Double Indirect
+      uint T_addr;		 //* Triple Indirect
+    };
+    struct {
+      struct exthdr eh;         //* Extent tree root (FSF_EXTENT)
+      struct extent ex[EXT_ROOTMAX];
+    };
+  };
 };
 
 // Inodes per block.
@@ -65,3 +137,32 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+//* Hash-indexed directories (FSF_HDIR).
+//* Block 0 keeps "." and ".." in slots 0 and 1 and holds the index root
+//* from slot DX_ROOTSLOT on; other index blocks start at slot 0. Leaf
+//* blocks are ordinary arrays of dirents. Index entries map a hash range
+//* [hash, next hash) to a child block, sorted by hash. Every index
+//* record is dirent-sized with inum 0, so code that reads a directory as
+//* a flat array of dirents (ls, isdirempty) just sees empty slots.
+#define DX_MAGIC 0xD1C7
+#define DX_ROOTSLOT 2
+#define DX_MAXDEPTH 3         //* index levels below the root
+#define DPB (BSIZE / sizeof(struct dirent))
+
+struct dxhead {
+  ushort inum;                //* always 0
+  ushort magic;               //* DX_MAGIC
+  uchar depth;                //* root only: index levels below it
+  uchar count;                //* entries that follow
+  ushort pad;
+  uint unused[2];
+};
+
+struct dxentry {
+  ushort inum;                //* always 0
+  ushort pad;
+  uint hash;                  //* lowest name hash of the child
+  uint blk;                   //* child's block number within the directory
+  uint unused;
+};
+
@@ -12,6 +12,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kprof.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -138,6 +139,7 @@ void
 iderw(struct buf *b)
 {
   struct buf **pp;
+  uint t0;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,6 +148,7 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
+  t0 = kprof_start();
   acquire(&idelock);  //DOC:acquire-lock
 
   // Append b to idequeue.
@@ -165,4 +168,5 @@ iderw(struct buf *b)
 
 
   release(&idelock);
+  kprof_end(KP_IDERW, t0);
 }
@@ -8,6 +8,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "kprof.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -83,7 +84,9 @@ char*
 kalloc(void)
 {
   struct run *r;
+  uint t0;
 
+  t0 = kprof_start();
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
@@ -91,6 +94,7 @@ kalloc(void)
     kmem.freelist = r->next;
   if(kmem.use_lock)
     release(&kmem.lock);
+  kprof_end(KP_KALLOC, t0);
   return (char*)r;
 }
 
@@ -0,0 +1,160 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "kprof.h"
+
+//* kprof [-r] [-c] [probe]: print the kernel probe counters.
+//*   -r      clear the counters first (then run the workload and
+//*           call kprof again)
+//*   -c      one line per CPU instead of the sum over all CPUs
+//*   probe   also print that probe's histogram
+
+#define KPROFDEV 2      // major number of the kprof device (file.h)
+#define DEVPATH  "/dev/kprof"
+
+char *names[NKPROBE] = {
+[KP_SYSCALL]  "syscall",
+[KP_TRAP]     "trap",
+[KP_SCHED]    "sched",
+[KP_BGET]     "bget",
+[KP_IDERW]    "iderw",
+[KP_BEGINOP]  "begin_op",
+[KP_ENDOP]    "end_op",
+[KP_KALLOC]   "kalloc",
+};
+
+struct kpstat st[NCPU][NKPROBE];
+
+// Sum probe k over all CPUs (cpu < 0) or take one CPU's counters.
+void
+collect(struct kpstat *s, int cpu, int k)
+{
+  int c, b;
+
+  memset(s, 0, sizeof(*s));
+  for(c = 0; c < NCPU; c++){
+    if(cpu >= 0 && c != cpu)
+      continue;
+    s->count += st[c][k].count;
+    if(st[c][k].max > s->max)
+      s->max = st[c][k].max;
+    for(b = 0; b < KPBUCKETS; b++)
+      s->hist[b] += st[c][k].hist[b];
+  }
+}
+
+// Upper bound, in cycles, of the bucket holding the pct'th percentile.
+uint
+percentile(struct kpstat *s, int pct)
+{
+  uint want, seen;
+  int b;
+
+  want = s->count / 100 * pct + s->count % 100 * pct / 100;
+  seen = 0;
+  for(b = 0; b < KPBUCKETS - 1; b++){
+    seen += s->hist[b];
+    if(seen > want)
+      break;
+  }
+  return b == KPBUCKETS - 1 ? 0xffffffff : (2u << b) - 1;
+}
+
+void
+line(int cpu, int k)
+{
+  struct kpstat s;
+
+  collect(&s, cpu, k);
+  if(s.count == 0)
+    return;
+  if(cpu >= 0)
+    printf(1, "cpu%d ", cpu);
+  printf(1, "%s: count %d p50 <%d p99 <%d max %d\n", names[k], s.count,
+         percentile(&s, 50), percentile(&s, 99), s.max);
+}
+
+void
+histogram(int k)
+{
+  struct kpstat s;
+  int b;
+
+  collect(&s, -1, k);
+  printf(1, "%s histogram (cycles: samples)\n", names[k]);
+  for(b = 0; b < KPBUCKETS; b++)
+    if(s.hist[b])
+      printf(1, "  %d-: %d\n", 1 << b, s.hist[b]);
+}
+
+//* Open the device node, making it if need be. It lives in /dev so it
+//* cannot be mistaken for the kprof program in /; anything there that
+//* is not a device is left alone.
+int
+opendev(void)
+{
+  struct stat st;
+  int fd;
+
+  if((fd = open(DEVPATH, O_RDWR)) < 0){
+    mkdir("/dev");
+    mknod(DEVPATH, KPROFDEV, 0);
+    fd = open(DEVPATH, O_RDWR);
+  }
+  if(fd < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || st.type != T_DEV){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, k, c, percpu, show;
+
+  percpu = 0;
+  show = -1;
+  if((fd = opendev()) < 0){
+    printf(2, "kprof: cannot open %s\n", DEVPATH);
+    exit();
+  }
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-r") == 0){
+      write(fd, "r", 1);
+      close(fd);
+      exit();
+    } else if(strcmp(argv[i], "-c") == 0){
+      percpu = 1;
+    } else {
+      for(k = 0; k < NKPROBE; k++)
+        if(strcmp(argv[i], names[k]) == 0)
+          show = k;
+      if(show < 0){
+        printf(2, "usage: kprof [-r] [-c] [probe]\n");
+        exit();
+      }
+    }
+  }
+
+  if(read(fd, st, sizeof(st)) != sizeof(st)){
+    printf(2, "kprof: short read\n");
+    exit();
+  }
+  close(fd);
+
+  for(k = 0; k < NKPROBE; k++){
+    if(percpu){
+      for(c = 0; c < NCPU; c++)
+        line(c, k);
+    } else
+      line(-1, k);
+  }
+  if(show >= 0)
+    histogram(show);
+  exit();
+}
@@ -0,0 +1,30 @@
+//* Kernel profiler (profile.c): rdtsc-timed probe points, counted per
+//* CPU into log2 histograms. Reading the kprof device returns
+//* struct kpstat [NCPU][NKPROBE]; writing to it clears the counters.
+
+#define KP_SYSCALL  0   // syscall(): one system call
+#define KP_TRAP     1   // trap(): one interrupt or fault
+#define KP_SCHED    2   // scheduler(): picking the next process
+#define KP_BGET     3   // bget(): finding and locking a buffer
+#define KP_IDERW    4   // iderw(): one disk request, queue to done
+#define KP_BEGINOP  5   // begin_opn(): waiting to start a transaction
+#define KP_ENDOP    6   // end_opn()
+#define KP_KALLOC   7   // kalloc()
+#define NKPROBE     8
+
+#define KPBUCKETS  32   // hist[i] counts samples of 2^i..2^(i+1)-1 cycles
+
+struct kpstat {
+  uint count;
+  uint max;             // longest sample, in cycles
+  uint hist[KPBUCKETS];
+};
+
+//* Sampling profiler (profile.c): every SPROF device write sets how
+//* many timer ticks pass between samples (0 stops sampling); reads
+//* drain struct ksample records from all CPUs.
+struct ksample {
+  uint eip;             // interrupted instruction
+  int pid;              // 0 if the CPU was in the kernel
+  char name[16];        // process name, to pick _name.sym
+};
@@ -0,0 +1,30 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+//* lockstat cmd [args...]: run cmd with the kernel lock counters
+//* zeroed, then print which locks it contended on.
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc < 2){
+    lockstat(0);
+    exit();
+  }
+  lockstat(1);
+  pid = fork();
+  if(pid < 0){
+    printf(2, "lockstat: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    printf(2, "lockstat: exec %s failed\n", argv[1]);
+    exit();
+  }
+  wait();
+  lockstat(0);
+  exit();
+}
@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kprof.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -28,9 +29,33 @@
 //   block C
 //   ...
 // Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+//
+//* Group commit (Project #3 buffered I/O).
+//* Commits are done by a dedicated kernel process, logd(), never by the
+//* system call that notices the log is full. A commit has two phases:
+//*   1. New FS calls wait while the open transaction's blocks are copied
+//*      to the log and the header is written (the commit point).
+//*   2. The committed transaction moves to a second in-memory header
+//*      (log.clh) and is installed from the log area, while new FS calls
+//*      already fill the next transaction in log.lh.
+//* Installing reads the logged copies and writes them home through a
+//* private buffer, so newer updates in the buffer cache are not clobbered.
+//* Each commit closes an epoch; sync() just waits for the epoch it was
+//* called in to reach disk.
+//* The on-disk format (struct dloghdr in fs.h) makes the header the
+//* checksummed commit record, so a commit costs one header write.
+//*
+//* Each FS call reserves the log blocks it may dirty: begin_op() takes
+//* MAXOPBLOCKS, begin_opn() takes as many as a bulk write needs, up to
+//* log_bulkmax(). A bulk write puts freshly allocated file blocks
+//* straight home with bwrite() before its transaction can commit, and
+//* logs only the metadata. Such a block must not be one the log may
+//* still write (or, after a crash, give back to its old file), so the
+//* blocks freed in the open and in the committing transaction are
+//* remembered until their frees are on disk; see log_reusable().
+
+//* In-memory list of logged block#s of a transaction.
+//* The on-disk header is struct dloghdr, see fs.h.
 struct logheader {
   int n;
   int block[LOGSIZE];
@@ -40,162 +65,379 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         //* max blocks per transaction that fit in size
+  int ndesc;       //* descriptor blocks for cap blocks
+  uint seq;        //* sequence number of the next commit
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    //* log blocks reserved by the outstanding calls
   int committing;  // in commit(), please wait.i
-  int flushing; //* wait until flushing ends - it has to be done without intervention.
+  int want;        //* someone asked logd for a commit
+  int installing;  //* phase 2 of a commit is running
+  uint epoch;      //* number of the open transaction
+  uint synced;     //* last epoch whose commit point is on disk
+  int nflushed;    //* blocks in the last commit
   int dev;
-  struct logheader lh;
+  struct logheader lh;   //* open transaction
+  struct logheader clh;  //* committed transaction being installed
+  uchar *freed;    //* bitmap of blocks freed in the open transaction
+  uchar *cfreed;   //* ... and in the one being committed/installed
 };
 struct log log;
 
+static uchar freedmap[2][FSSIZE/8 + 1];
+
+//* Private buffer for installing blocks; never in the buffer cache.
+static struct buf ibuf;
+
 static void recover_from_log(void);
-int sync(void);
-int flush(void);
-//static void commit();
+
+//* CRC-32 (IEEE), used to checksum commit records.
+static uint crctab[256];
+
+static void
+crcinit(void)
+{
+  uint c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    crctab[i] = c;
+  }
+}
+
+static uint
+crc32(uint crc, void *p, int n)
+{
+  uchar *s = p;
+
+  crc = ~crc;
+  while (n-- > 0)
+    crc = crctab[(crc ^ *s++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct dloghdr) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  initsleeplock(&ibuf.lock, "logibuf");
+  crcinit();
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  log.epoch = 1;
+  log.freed = freedmap[0];
+  log.cfreed = freedmap[1];
+  //* Largest transaction whose blocks and descriptors fit in the log.
+  for (log.cap = LOGSIZE; log.cap > 0 && LOGBLOCKS(log.cap) > log.size; log.cap--)
+    ;
+  if (log.cap < MAXOPBLOCKS + 2)
+    panic("initlog: log too small");
+  log.ndesc = LOGNDESC(log.cap);
   recover_from_log();
 }
 
+//* Disk block holding the tail'th logged block.
+#define LOGBLK(tail) (log.start + 1 + log.ndesc + (tail))
+
 // Copy committed blocks from log to their home location
+//* Writes go through ibuf, leaving cached copies of the home blocks alone.
 static void
-install_trans(void)
+install_trans(struct logheader *lh)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+  for (tail = 0; tail < lh->n; tail++) {
+    struct buf *lbuf = bread(log.dev, LOGBLK(tail)); // read log block
+    acquiresleep(&ibuf.lock);
+    ibuf.dev = log.dev;
+    ibuf.blockno = lh->block[tail];
+    ibuf.flags = B_DIRTY;
+    memmove(ibuf.data, lbuf->data, BSIZE);  // copy block to dst
+    iderw(&ibuf);  // write dst to disk
+    releasesleep(&ibuf.lock);
     brelse(lbuf);
-    brelse(dbuf);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+//* Let the buffer cache evict the installed blocks again,
+//* unless the open transaction has logged them since.
 static void
-read_head(void)
+unpin_trans(struct logheader *lh)
+{
+  int tail, i;
+  struct buf *b;
+
+  for (tail = 0; tail < lh->n; tail++) {
+    b = bread(log.dev, lh->block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++)
+      if (log.lh.block[i] == b->blockno)
+        break;
+    if (i == log.lh.n)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
+  }
+}
+
+//* Checksum of a transaction: seq, n, block#s, then each logged block.
+//* The logged blocks are read back from the log area.
+static uint
+trans_csum(uint seq, struct logheader *h)
+{
+  uint c, n;
+  int tail;
+  struct buf *lbuf;
+
+  n = h->n;
+  c = crc32(0, &seq, sizeof(seq));
+  c = crc32(c, &n, sizeof(n));
+  c = crc32(c, h->block, h->n * sizeof(h->block[0]));
+  for (tail = 0; tail < h->n; tail++) {
+    lbuf = bread(log.dev, LOGBLK(tail));
+    c = crc32(c, lbuf->data, BSIZE);
+    brelse(lbuf);
+  }
+  return c;
+}
+
+// Read the log header from disk into the in-memory log header
+//* Returns 0 (and h->n = 0) unless the header and descriptors describe a
+//* transaction whose checksum matches what is in the log.
+static int
+read_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct dloghdr *lh = (struct dloghdr *) (buf->data);
+  struct buf *dbuf;
+  uint *d;
+  uint seq, csum;
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+
+  h->n = 0;
+  if (lh->magic != LOGMAGIC || lh->n > log.cap) {
+    brelse(buf);
+    return 0;
+  }
+  h->n = lh->n;
+  seq = lh->seq;
+  csum = lh->csum;
+  for (i = 0; i < h->n && i < LOGHDRN; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
+  for (; i < h->n; i++) {
+    dbuf = bread(log.dev, log.start + 1 + (i - LOGHDRN) / LOGDESCN);
+    d = (uint*)dbuf->data;
+    h->block[i] = d[(i - LOGHDRN) % LOGDESCN];
+    brelse(dbuf);
+  }
+  log.seq = seq + 1;
+  if (trans_csum(seq, h) != csum) {
+    h->n = 0;
+    return 0;
+  }
+  return 1;
 }
 
 // Write in-memory log header to disk.
 // This is the true point at which the
 // current transaction commits.
+//* Descriptor blocks go first; the header with the checksum is the
+//* single write that commits.
 static void
-write_head(void)
+write_head(struct logheader *h, uint csum)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
+  struct buf *buf;
+  struct dloghdr *hb;
+  uint *d;
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+
+  for (i = LOGHDRN; i < h->n; i += LOGDESCN) {
+    buf = bread(log.dev, log.start + 1 + (i - LOGHDRN) / LOGDESCN);
+    d = (uint*)buf->data;
+    memmove(d, &h->block[i], (h->n - i < LOGDESCN ? h->n - i : LOGDESCN) * sizeof(uint));
+    bwrite(buf);
+    brelse(buf);
+  }
+
+  buf = bread(log.dev, log.start);
+  hb = (struct dloghdr *) (buf->data);
+  hb->magic = LOGMAGIC;
+  hb->seq = log.seq++;
+  hb->n = h->n;
+  hb->csum = csum;
+  for (i = 0; i < h->n && i < LOGHDRN; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+//* Replaying the last committed transaction is harmless even if it was
+//* installed before, so the log is not cleared afterwards.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  if (read_head(&log.clh))
+    install_trans(&log.clh); // if committed, copy from log to disk
+  log.clh.n = 0;
 }
 
 // called at the start of each FS system call.
 //* Changed feature in Project #3 - Buffered I/O
-//* begin_op will do one more job; call sync() if buffer fulled.
+//* The log is committed only when it runs full or on sync().
 //* Standard of full: LOGSIZE - 2 (Some blocks need to be reserved for log operation. I set this reserve amount as 2 blocks.)
-//* Based on log number and # outstanding blocks, check if the log full.
-//* If the log full, call sync(), flush the buffer. 
+//* If this op might not fit, ask logd for a commit and wait for it;
+//* that is the only case in which begin_op() blocks, apart from the
+//* short first phase of a commit.
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+//* begin_op() for a call that may log up to n blocks.
+void
+begin_opn(int n)
+{
+  uint t0;
+
+  if(n > log_bulkmax())
+    panic("begin_opn: too many blocks");
+  t0 = kprof_start();
   acquire(&log.lock);
   while(1){
-    if(log.committing){ 
+    if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE - 2){ //* Reserve for 2 block for log operation
+    } else if(log.lh.n + log.reserved + n > log.cap - 2){ //* Reserve for 2 block for log operation
       // this op might exhaust log space; wait for commit.
-      //sleep(&log, &log.lock);
-      sync();
+      log.want = 1;
+      wakeup(&log.want);
+      sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
+  kprof_end(KP_BEGINOP, t0);
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 //* Changed feature in Project #3 - buffered I/O
-//* Commit will NOT flush buffer.
-//* Flush will be totally managed by systemcall sync();
+//* Commit will NOT flush buffer; logd does.
 //* end_op will now just resolve outstanding block; reduce the number if end_op called.
 //* It will work like an 'marker'. (Mark the range of operation need to be logged.)
 void
 end_op(void)
 {
+  end_opn(MAXOPBLOCKS);
+}
+
+//* end_op() for a call started with begin_opn(n).
+void
+end_opn(int n)
+{
+  uint t0;
+
+  t0 = kprof_start();
   acquire(&log.lock);
   //* Resolve Outstanding Block
   log.outstanding -= 1;
+  log.reserved -= n;
 
-  if (log.outstanding == 0){
-    //* It won't call sync
-    //* As all outstanding blocks are resloved,
-    //* Wake the log wating the outstanding blocks to be resolved.
-    wakeup(&log); //* This wakeup is for waiting log in sync();
-  }
+  //* Wake logd if it waits for the last op of the epoch to end,
+  //* and begin_opn() callers waiting for the reservation to free up.
+  wakeup(&log);
 
-  //* for the case log.outstanding > 0
-  //* begin_op() will now not sleep if the buffer is full.
-  //* No need to wait such condition; begin_op will immediately flush the buffer.
+  release(&log.lock);
+  kprof_end(KP_ENDOP, t0);
+}
 
+//* Largest reservation begin_opn() accepts: a quarter of the log,
+//* so a bulk writer leaves room for the other FS calls.
+int
+log_bulkmax(void)
+{
+  return log.cap / 4 > MAXOPBLOCKS ? log.cap / 4 : MAXOPBLOCKS;
+}
+
+//* Wait until the last committed transaction is installed. Called by
+//* an FS call, so no later commit can start meanwhile.
+void
+log_waitinstall(void)
+{
+  acquire(&log.lock);
+  while(log.installing)
+    sleep(&log.installing, &log.lock);
+  release(&log.lock);
+}
+
+//* Record that block b was freed by the open transaction.
+void
+log_free(uint b)
+{
+  if(b / 8 >= sizeof(freedmap[0]))
+    return;
+  acquire(&log.lock);
+  log.freed[b/8] |= 1 << (b % 8);
   release(&log.lock);
 }
 
+//* May the free block b be written home directly, outside the log?
+//* Not if it was freed by a transaction whose free is not yet on disk,
+//* or whose logged copies are still being installed.
+int
+log_reusable(uint b)
+{
+  int r;
+
+  if(b / 8 >= sizeof(freedmap[0]))
+    return 0;
+  acquire(&log.lock);
+  r = ((log.freed[b/8] | log.cfreed[b/8]) & (1 << (b % 8))) == 0;
+  release(&log.lock);
+  return r;
+}
+
 // Copy modified blocks from cache to log.
-static void
-write_log(void)
+//* Returns the transaction checksum for write_head().
+static uint
+write_log(struct logheader *lh)
 {
   int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  uint c, n;
+
+  n = lh->n;
+  c = crc32(0, &log.seq, sizeof(log.seq));
+  c = crc32(c, &n, sizeof(n));
+  c = crc32(c, lh->block, lh->n * sizeof(lh->block[0]));
+  for (tail = 0; tail < lh->n; tail++) {
+    struct buf *to = bread(log.dev, LOGBLK(tail)); // log block
+    struct buf *from = bread(log.dev, lh->block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
+    c = crc32(c, to->data, BSIZE);
     bwrite(to);  // write the log
     brelse(from);
     brelse(to);
   }
+  return c;
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// logd()/write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -207,7 +449,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -225,73 +467,90 @@ log_write(struct buf *b)
 }
 
 
-//* sync()
-//* sync will check the buffer and flush it.
-// Step 1) If the lock isn't held (e.g. called from user program.) it will internally acquire log.lock.
-// Step 2) If there is still outstanding block, wait until it resolved (wait until end_op calls)
-// Step 3) Flush the buffer, write the changes on the disk
-// Step 4) if the log.lock acquired internally, release it.
-int
-sync(void){
-  int logLocked = log.lock.locked; //* check log lock state
-  int blockConsumed = 0; //* Value need to be returned; # block flushed.
+//* commit()
+//* Commit the open transaction in the two phases described at the top.
+static void
+commit(void)
+{
+  int n;
+  uchar *p;
 
-  if(logLocked == 0){ //* If the lock isn't held
-    acquire(&log.lock); //* Call Internally
-  }
+  //* Phase 1: close the epoch and write its commit point.
+  acquire(&log.lock);
+  log.committing = 1;
+  while(log.outstanding > 0)
+    sleep(&log, &log.lock);
+  release(&log.lock);
 
-  while(log.outstanding > 0){ //* If there is an outstanding block
-    sleep(&log, &log.lock); //* Wait for it
-  }
+  n = log.lh.n;
+  if(n > 0)
+    write_head(&log.lh, write_log(&log.lh));
 
-  blockConsumed = flush(); //* Flush buffers
+  acquire(&log.lock);
+  log.clh = log.lh;
+  log.lh.n = 0;
+  p = log.cfreed;         //* empty: the last install is done
+  log.cfreed = log.freed;
+  log.freed = p;
+  log.synced = log.epoch++;
+  log.nflushed = n;
+  log.committing = 0;
+  log.installing = 1;
+  wakeup(&log); //* begin_op() and sync() waiters
+  release(&log.lock);
 
-  if(logLocked == 0){ //* If the lock called internally
-    release(&log.lock);   //* release the lock.
+  //* Phase 2: install while the next epoch fills log.lh.
+  if(n > 0){
+    install_trans(&log.clh);
+    unpin_trans(&log.clh);
+    log.clh.n = 0;
   }
+  acquire(&log.lock);
+  memset(log.cfreed, 0, sizeof(freedmap[0]));
+  log.installing = 0;
+  wakeup(&log.installing);
+  release(&log.lock);
+}
 
-  return blockConsumed; //* Return # block flushed
+//* logd()
+//* The log writer: a kernel process that performs every commit.
+//* Whoever wants a commit sets log.want and wakes it; all FS calls
+//* that joined the open transaction by then are committed together.
+void
+logd(void)
+{
+  for(;;){
+    acquire(&log.lock);
+    while(!log.want)
+      sleep(&log.want, &log.lock);
+    log.want = 0;
+    release(&log.lock);
+
+    commit();
+  }
 }
 
-//* flush()
-//* flush will do the original commit job.
-//* remove the all elements in buffer, and write those contents into disk.
+//* sync()
+//* Wait until everything logged so far is on disk.
+//* Returns the number of blocks in the commit that covered it.
 int
-flush(void){
-  int flushed = 0;
-
-  //* Prevent flush if currenlty commiting
-  log.committing = 1;
-  release(&log.lock); //* release the log lock
-  log.flushing = 1; //* Flush start; Another sync() call will be ignored.
-
-  if(log.lh.n > 0) { //* Original Commit Call
-    //* Flush buffer.
-    write_log();
-    write_head();
-    install_trans();
-    flushed = log.lh.n;
-    log.lh.n = 0;
-    write_head();
-  }
+sync(void){
+  int blockConsumed; //* Value need to be returned; # block flushed.
+  uint epoch;
 
-  acquire(&log.lock); //* acquire the log lock
-  //* release & acquire are implemented in here based on original end_op call.
-  //* without these calls, it will panic ("sched locks"), which is a deadlock in xv6.
-  log.committing = 0;
-  log.flushing = 0; //* Flush end; Now another sync() call will be allowed.
+  acquire(&log.lock);
+  epoch = log.epoch;
+  log.want = 1;
+  wakeup(&log.want);
+  while(log.synced < epoch)
+    sleep(&log, &log.lock);
+  blockConsumed = log.nflushed;
+  release(&log.lock);
 
-  return flushed;
+  return blockConsumed; //* Return # block flushed
 }
 
 int
 sys_sync(){
-  if(log.flushing == 1){
-    //* Currently flushing buffers!
-    cprintf("sync: busy!\n");
-    return -1;
-  }
-  
   return sync();
 }
-
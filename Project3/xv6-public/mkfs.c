@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGBLOCKS(LOGSIZE);  //* header + descriptors + LOGSIZE blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -31,6 +31,7 @@ struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+uint features;   //* superblock feature flags (FSF_*)
 
 
 void balloc(int);
@@ -76,8 +77,35 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  //* -e: build an extent-mapped file system (FSF_EXTENT)
+  //* -d: index directories that outgrow one block (FSF_HDIR)
+  //* -l n: size the log for n blocks per transaction (at most LOGSIZE)
+  //* -j: journal file data too, instead of ordered mode (FSF_ORDERED)
+  features = FSF_ORDERED;
+  while(argc > 1 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-e") == 0){
+      features |= FSF_EXTENT;
+    } else if(strcmp(argv[1], "-d") == 0){
+      features |= FSF_HDIR;
+    } else if(strcmp(argv[1], "-j") == 0){
+      features &= ~FSF_ORDERED;
+    } else if(strcmp(argv[1], "-l") == 0 && argc > 2){
+      i = atoi(argv[2]);
+      if(i < MAXOPBLOCKS*3 || i > LOGSIZE){
+        fprintf(stderr, "mkfs: log size must be %d..%d\n", MAXOPBLOCKS*3, LOGSIZE);
+        exit(1);
+      }
+      nlog = LOGBLOCKS(i);
+      argc--;
+      argv++;
+    } else
+      break;
+    argc--;
+    argv++;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-e] [-d] [-j] [-l nblocks] fs.img files...\n");
     exit(1);
   }
 
@@ -101,6 +129,7 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.features = xint(features);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -230,6 +259,8 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  if((features & FSF_EXTENT) && (type == T_FILE || type == T_DIR))
+    din.eh.magic = xshort(EXT_MAGIC);
   winode(inum, &din);
   return inum;
 }
@@ -252,6 +283,38 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+//* Block number of logical block fbn in an extent-mapped inode,
+//* allocating it if necessary. mkfs hands out blocks sequentially, so
+//* a file grows its last extent unless another file was appended in
+//* between; the root in the inode must be enough for every file.
+uint
+ext_bmap(struct dinode *din, uint fbn)
+{
+  int i, n;
+  struct extent *e;
+
+  n = din->eh.entries;
+  for(i = 0; i < n; i++){
+    e = &din->ex[i];
+    if(fbn >= xint(e->lblk) && fbn < xint(e->lblk) + xint(e->len))
+      return xint(e->start) + fbn - xint(e->lblk);
+  }
+  if(n > 0){
+    e = &din->ex[n-1];
+    if(xint(e->start) + xint(e->len) == freeblock){
+      e->len = xint(xint(e->len) + 1);
+      return freeblock++;
+    }
+  }
+  assert(n < EXT_ROOTMAX);
+  e = &din->ex[n];
+  e->lblk = xint(fbn);
+  e->start = xint(freeblock);
+  e->len = xint(1);
+  din->eh.entries = n + 1;
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -268,7 +331,9 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(xshort(din.eh.magic) == EXT_MAGIC){
+      x = ext_bmap(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
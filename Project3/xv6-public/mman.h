@@ -0,0 +1,8 @@
+//* mmap() protections and flags
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_SHARED  0x1   //* stores reach the file (written back at munmap)
+#define MAP_PRIVATE 0x2   //* copy-on-fault; stores stay in the process
+
+#define MAP_FAILED ((void*)-1)
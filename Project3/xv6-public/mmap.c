@@ -0,0 +1,492 @@
+//* File page cache and mmap().
+//*
+//* The page cache holds page-sized pieces of files, keyed by
+//* (dev, inum, page number). A MAP_SHARED mapping maps the cached page
+//* itself into the process, so every process mapping the file shares
+//* one copy; a MAP_PRIVATE mapping gets its own copy of the page when
+//* it first touches it. Pages are brought in by page faults (see
+//* trap.c), not by mmap() itself.
+//*
+//* The cache stays coherent with the buffer cache: writei() updates any
+//* cached page it overlaps, readi() prefers a cached page, and a shared
+//* page that the process wrote is written back through writei() when it
+//* is unmapped.
+//*
+//* A page is pinned while it is mapped (cp->ref > 0); unpinned pages
+//* are recycled least recently used first.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+#define NPHASH 61
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint pgno;
+  int valid;              // has an identity
+  int ref;                // mappings + users in progress
+  char *data;             // kalloc'd page, or 0 until first use
+  struct cpage *hnext;    // hash chain
+  struct cpage *prev;     // LRU list
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPHASH];
+  struct cpage head;      // head.next is most recently used
+  int nvalid;             // pages with an identity
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct cpage *cp;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(cp = pcache.page; cp < pcache.page+NPCACHE; cp++){
+    cp->next = pcache.head.next;
+    cp->prev = &pcache.head;
+    pcache.head.next->prev = cp;
+    pcache.head.next = cp;
+  }
+}
+
+static struct cpage**
+phash(uint dev, uint inum, uint pgno)
+{
+  return &pcache.hash[(dev*31 + inum*17 + pgno) % NPHASH];
+}
+
+// Caller holds pcache.lock.
+static struct cpage*
+pfind(uint dev, uint inum, uint pgno)
+{
+  struct cpage *cp;
+
+  for(cp = *phash(dev, inum, pgno); cp; cp = cp->hnext)
+    if(cp->dev == dev && cp->inum == inum && cp->pgno == pgno)
+      return cp;
+  return 0;
+}
+
+// Caller holds pcache.lock.
+static void
+punhash(struct cpage *cp)
+{
+  struct cpage **pp;
+
+  for(pp = phash(cp->dev, cp->inum, cp->pgno); *pp != cp; pp = &(*pp)->hnext)
+    ;
+  *pp = cp->hnext;
+  cp->valid = 0;
+  pcache.nvalid--;
+}
+
+// Caller holds pcache.lock.
+static void
+ptouch(struct cpage *cp)
+{
+  cp->next->prev = cp->prev;
+  cp->prev->next = cp->next;
+  cp->next = pcache.head.next;
+  cp->prev = &pcache.head;
+  pcache.head.next->prev = cp;
+  pcache.head.next = cp;
+}
+
+// Caller holds pcache.lock.
+static struct cpage*
+pbydata(char *data)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.page; cp < pcache.page+NPCACHE; cp++)
+    if(cp->data == data)
+      return cp;
+  panic("pcache: not a cached page");
+}
+
+//* Return page pgno of ip, reading it in if needed, with a reference
+//* the caller must drop with pcache_put(). Returns 0 if every page in
+//* the cache is pinned or memory is short.
+// Caller must hold ip->lock.
+char*
+pcache_get(struct inode *ip, uint pgno)
+{
+  struct cpage *cp;
+  uint off;
+  int n;
+
+  acquire(&pcache.lock);
+  if((cp = pfind(ip->dev, ip->inum, pgno)) != 0){
+    cp->ref++;
+    ptouch(cp);
+    release(&pcache.lock);
+    return cp->data;
+  }
+  for(cp = pcache.head.prev; cp != &pcache.head; cp = cp->prev)
+    if(cp->ref == 0)
+      break;
+  if(cp == &pcache.head || (cp->data == 0 && (cp->data = kalloc()) == 0)){
+    release(&pcache.lock);
+    return 0;
+  }
+  if(cp->valid)
+    punhash(cp);
+  cp->dev = ip->dev;
+  cp->inum = ip->inum;
+  cp->pgno = pgno;
+  cp->ref = 1;
+  ptouch(cp);
+  release(&pcache.lock);
+
+  // Nobody else can look this page up before we are done:
+  // that also takes ip->lock.
+  off = pgno * PGSIZE;
+  n = 0;
+  if(off < ip->size)
+    n = readi(ip, cp->data, off, PGSIZE);
+  if(n < 0)
+    n = 0;
+  memset(cp->data + n, 0, PGSIZE - n);
+
+  acquire(&pcache.lock);
+  cp->hnext = *phash(cp->dev, cp->inum, cp->pgno);
+  *phash(cp->dev, cp->inum, cp->pgno) = cp;
+  cp->valid = 1;
+  pcache.nvalid++;
+  release(&pcache.lock);
+  return cp->data;
+}
+
+//* Take another reference to a page pcache_get() returned.
+void
+pcache_dup(char *data)
+{
+  acquire(&pcache.lock);
+  pbydata(data)->ref++;
+  release(&pcache.lock);
+}
+
+void
+pcache_put(char *data)
+{
+  struct cpage *cp;
+
+  acquire(&pcache.lock);
+  cp = pbydata(data);
+  if(cp->ref < 1)
+    panic("pcache_put");
+  cp->ref--;
+  release(&pcache.lock);
+}
+
+//* Copy n bytes at off of ip from the page cache, if that page is
+//* cached; the range must not cross a page. Returns 0 on a miss.
+// Caller must hold ip->lock.
+int
+pcache_read(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct cpage *cp;
+
+  if(pcache.nvalid == 0)
+    return 0;
+  acquire(&pcache.lock);
+  if((cp = pfind(ip->dev, ip->inum, off / PGSIZE)) == 0){
+    release(&pcache.lock);
+    return 0;
+  }
+  cp->ref++;
+  release(&pcache.lock);
+  memmove(dst, cp->data + off % PGSIZE, n);
+  acquire(&pcache.lock);
+  cp->ref--;
+  release(&pcache.lock);
+  return 1;
+}
+
+//* writei() wrote n bytes at off of ip: update any cached page.
+// Caller must hold ip->lock.
+void
+pcache_write(struct inode *ip, char *src, uint off, uint n)
+{
+  struct cpage *cp;
+  uint pgno, m;
+
+  if(pcache.nvalid == 0)
+    return;
+  for(; n > 0; n -= m, off += m, src += m){
+    pgno = off / PGSIZE;
+    m = PGSIZE - off % PGSIZE;
+    if(m > n)
+      m = n;
+    acquire(&pcache.lock);
+    cp = pfind(ip->dev, ip->inum, pgno);
+    if(cp)
+      cp->ref++;
+    release(&pcache.lock);
+    if(cp){
+      if(cp->data + off % PGSIZE != src)
+        memmove(cp->data + off % PGSIZE, src, m);
+      acquire(&pcache.lock);
+      cp->ref--;
+      release(&pcache.lock);
+    }
+  }
+}
+
+//* Forget the pages of an inode that is being freed.
+void
+pcache_inval(uint dev, uint inum)
+{
+  struct cpage *cp;
+
+  if(pcache.nvalid == 0)
+    return;
+  acquire(&pcache.lock);
+  for(cp = pcache.page; cp < pcache.page+NPCACHE; cp++)
+    if(cp->valid && cp->dev == dev && cp->inum == inum && cp->ref == 0)
+      punhash(cp);
+  release(&pcache.lock);
+}
+
+//PAGEBREAK!
+// Mappings
+
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->f && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+//* Map len bytes of f starting at off (page aligned) into the current
+//* process. Returns the address, or -1.
+int
+mmap(struct file *f, uint len, int prot, int flags, uint off)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *free;
+  uint start;
+  int i;
+
+  len = PGROUNDUP(len);
+  free = 0;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->f == 0 && free == 0)
+      free = v;
+  if(free == 0 || len == 0)
+    return -1;
+
+  // First fit in [MMAPBASE, KERNBASE).
+  start = MMAPBASE;
+  for(i = 0; i < NVMA; i++){
+    v = &curproc->vma[i];
+    if(v->f && start < v->end && start + len > v->start){
+      start = v->end;
+      i = -1;  // rescan
+    }
+  }
+  if(start + len > KERNBASE || start + len < start)
+    return -1;
+
+  free->start = start;
+  free->end = start + len;
+  free->prot = prot;
+  free->flags = flags;
+  free->off = off;
+  free->f = filedup(f);
+  return start;
+}
+
+//* Bring in the page holding va for p. Returns -1 if va is not in a
+//* mapping that allows the access.
+int
+mmapfault(struct proc *p, uint va, int write)
+{
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *page, *mem;
+  int perm;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;  // present: a protection fault
+
+  ip = v->f->ip;
+  ilock(ip);
+  page = pcache_get(ip, (v->off + va - v->start) / PGSIZE);
+  iunlock(ip);
+  if(page == 0)
+    return -1;
+
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->flags & MAP_SHARED){
+    if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(page), perm) < 0){
+      pcache_put(page);
+      return -1;
+    }
+    return 0;
+  }
+
+  mem = kalloc();
+  if(mem)
+    memmove(mem, page, PGSIZE);
+  pcache_put(page);
+  if(mem == 0 || mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    if(mem)
+      kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+//* Make sure [va, va+n) is mapped for the current process, faulting
+//* pages in, so system calls can use an mmap()ed buffer.
+//* write: the kernel will store into it.
+int
+mmapuva(uint va, uint n, int write)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  pte_t *pte;
+  uint a;
+
+  if((v = vmafind(curproc, va)) == 0 || va + n > v->end || va + n < va)
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && mmapfault(curproc, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+//* Tear down mapping v in pgdir: write back dirty shared pages, drop
+//* the pages and the file reference.
+static void
+vmafree(struct vma *v, pde_t *pgdir)
+{
+  struct inode *ip;
+  pte_t *pte;
+  char *page;
+  uint a, off;
+  int n;
+
+  ip = v->f->ip;
+  for(a = v->start; a < v->end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    page = P2V(PTE_ADDR(*pte));
+    if(v->flags & MAP_PRIVATE){
+      kfree(page);
+    } else {
+      if((*pte & PTE_D) && v->f->writable){
+        off = v->off + a - v->start;
+        begin_op();
+        ilock(ip);
+        if(off < ip->size){
+          n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+          writei(ip, page, off, n);
+        }
+        iunlock(ip);
+        end_op();
+      }
+      pcache_put(page);
+    }
+    *pte = 0;
+  }
+  fileclose(v->f);
+  v->f = 0;
+}
+
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  //* Only whole mappings can be unmapped.
+  if((v = vmafind(curproc, addr)) == 0 || v->start != addr ||
+     PGROUNDUP(len) != v->end - v->start)
+    return -1;
+  vmafree(v, curproc->pgdir);
+  lcr3(V2P(curproc->pgdir));  // flush TLB
+  return 0;
+}
+
+//* Drop every mapping of p from pgdir (exit, exec).
+void
+munmapall(struct proc *p, pde_t *pgdir)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->f)
+      vmafree(v, pgdir);
+}
+
+//* fork: give np the mappings of p. Shared pages that are in are
+//* mapped again; private pages are copied.
+int
+mmapdup(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *page, *mem;
+  uint a;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->f == 0)
+      continue;
+    np->vma[v - p->vma] = *v;
+    np->vma[v - p->vma].f = filedup(v->f);
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+        continue;
+      page = P2V(PTE_ADDR(*pte));
+      if(v->flags & MAP_SHARED){
+        if(mappages(np->pgdir, (char*)a, PGSIZE, V2P(page), PTE_FLAGS(*pte) & ~PTE_D) < 0)
+          return -1;
+        pcache_dup(page);
+      } else {
+        if((mem = kalloc()) == 0)
+          return -1;
+        memmove(mem, page, PGSIZE);
+        if(mappages(np->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0){
+          kfree(mem);
+          return -1;
+        }
+      }
+    }
+  }
+  return 0;
+}
@@ -3,12 +3,27 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE     1000  // maximum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXIOV       16  //* max buffers per readv()/writev()
+#define MAXPATH     128  //* max path name the kernel builds while resolving
+#define MAXSYMLINKS   8  //* max symbolic links followed in one lookup
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF       2500  // size of disk block cache
+                         //* static, so kernel end must stay below the 4 MB
+                         //* kinit1() maps: about 620 KB per 1000 buffers
+#define LOGSIZE      ((NBUF-MAXOPBLOCKS)/2)  // max data blocks in on-disk log
+                         //* the open and the installing transaction are both
+                         //* pinned in the cache; mkfs picks the size (sb.nlog)
 #define FSSIZE       100000  // size of file system in blocks
+#define NPCACHE      256  //* file pages cached for mmap()
+#define NVMA          8  //* mmap() regions per process
+#define PIPEPAGES     4  //* pages in each pipe's ring buffer
+#define LOCKSTAT      1  //* keep per-lock contention counters
+#define NLOCKSTAT    64  //* distinct lock names counted
+#define KPROBES       1  //* time the kprof.h probe points
+#define NSAMPLE    2048  //* timer samples buffered per CPU
+#define KSUPERPAGE    1  //* map the kernel with 4 MB pages where aligned
 
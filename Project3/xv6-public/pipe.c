@@ -8,21 +8,57 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+//* The ring is PIPEPAGES separate pages; data are copied in runs that
+//* stay within one page so each run is a single memmove. struct pipe
+//* sits at the start of the first page and the ring begins after it,
+//* so ring position pos is byte pos + PIPEHDR of the pages laid end to
+//* end. PIPESIZE is no power of two, so nread and nwrite are kept below
+//* 2*PIPESIZE rather than left to wrap around.
+#define PIPEHDR  sizeof(struct pipe)
+#define PIPESIZE (PIPEPAGES*PGSIZE - PIPEHDR)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];  //* data[0] is the page holding the pipe
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+//* Free p's ring pages, the first one holding p itself.
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = PIPEPAGES-1; i >= 0; i--)
+    if(p->data[i])
+      kfree(p->data[i]);
+}
+
+//* Where ring position pos is.
+static char*
+pipeaddr(struct pipe *p, uint pos)
+{
+  pos = pos % PIPESIZE + PIPEHDR;
+  return p->data[pos / PGSIZE] + pos % PGSIZE;
+}
+
+//* Longest run starting at ring position pos that stays in one page.
+static int
+piperun(uint pos, int n)
+{
+  int m = PGSIZE - (pos % PIPESIZE + PIPEHDR) % PGSIZE;
+
+  return n < m ? n : m;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,6 +66,11 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  p->data[0] = (char*)p;
+  for(i = 1; i < PIPEPAGES; i++)
+    if((p->data[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +89,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,7 +110,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
@@ -78,10 +119,10 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
@@ -90,7 +131,11 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = piperun(p->nwrite, n - i);
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    memmove(pipeaddr(p, p->nwrite), addr + i, m);
+    p->nwrite += m;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
@@ -100,7 +145,7 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,10 +155,16 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = piperun(p->nread, n - i);
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    memmove(addr + i, pipeaddr(p, p->nread), m);
+    p->nread += m;
+  }
+  if(p->nread >= PIPESIZE){
+    p->nread -= PIPESIZE;
+    p->nwrite -= PIPESIZE;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
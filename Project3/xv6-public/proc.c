@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "kprof.h"
 
 struct {
   struct spinlock lock;
@@ -115,6 +116,25 @@ found:
   return p;
 }
 
+//* Start a kernel process that runs fn(), which must never return.
+//* It has no user memory; its page table maps only the kernel.
+//* forkret() returns straight into fn instead of trapret.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kproc");
+  p->sz = 0;
+  *(uint*)((char*)p->context + sizeof(*p->context)) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -163,6 +183,8 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
+    if(sz + n > MMAPBASE)  //* keep clear of mmap() regions
+      return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -200,6 +222,15 @@ fork(void)
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
+  if(mmapdup(np, curproc) < 0){
+    munmapall(np, np->pgdir);
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
@@ -234,6 +265,8 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  munmapall(curproc, curproc->pgdir);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -324,6 +357,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  uint t0;
   c->proc = 0;
   
   for(;;){
@@ -331,7 +365,10 @@ scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    //* KP_SCHED times the search from here, or from the last
+    //* switch back, to the next swtch().
     acquire(&ptable.lock);
+    t0 = kprof_start();
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
@@ -343,8 +380,10 @@ scheduler(void)
       switchuvm(p);
       p->state = RUNNING;
 
+      kprof_end(KP_SCHED, t0);
       swtch(&(c->scheduler), p->context);
       switchkvm();
+      t0 = kprof_start();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -415,6 +454,9 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    kproc("logd", logd);         //* commits the log
+    iorphans(ROOTDEV);           //* before any user code runs
+    kproc("reclaim", ireclaim);  //* frees big unlinked files
   }
 
   // Return to "caller", actually trapret (see allocproc).
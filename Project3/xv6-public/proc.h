@@ -36,6 +36,16 @@ struct context {
 };
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+
+//* A file region mapped by mmap(); pages are brought in on fault.
+struct vma {
+  uint start;                  //* first address (page aligned)
+  uint end;                    //* one past the last
+  int prot;                    //* PROT_*
+  int flags;                   //* MAP_SHARED or MAP_PRIVATE
+  struct file *f;              //* mapped file; 0 if the slot is free
+  uint off;                    //* file offset of start
+};
 enum lockstate { LOCKED, UNLOCKED };
 
 // Per-process state
@@ -61,6 +71,7 @@ struct proc {
   int tq;		       //* Time Quantum: tq for each process.
   enum lockstate lock;	       //* Lock: check if current process calls schedulerLock / schedulerUnlock
   uint arrived;		       //* Arrived: arrived order of process. Value will be assigned if it comes to L2.
+  struct vma vma[NVMA];        //* mmap()ed regions
 };
 
 // Process memory is laid out contiguously, low addresses first:
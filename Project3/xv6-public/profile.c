@@ -0,0 +1,158 @@
+//* Kernel profiler. A probe point takes kprof_start() on entry and
+//* calls kprof_end() with its KP_ number on the way out; the elapsed
+//* TSC cycles go into this CPU's histogram for that probe, so CPUs
+//* never share a counter and no lock is taken.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kprof.h"
+
+static struct kpstat kpstats[NCPU][NKPROBE];
+
+uint
+kprof_start(void)
+{
+  return KPROBES ? rdtsc() : 0;
+}
+
+void
+kprof_end(int probe, uint t0)
+{
+  struct kpstat *s;
+  uint d;
+  int b;
+
+  //* Early in boot (before mpinit()) cpuid() cannot work yet.
+  if(!KPROBES || ncpu == 0)
+    return;
+  d = rdtsc() - t0;
+  for(b = 0; b < KPBUCKETS - 1 && (d >> (b + 1)) != 0; b++)
+    ;
+  pushcli();
+  s = &kpstats[cpuid()][probe];
+  s->count++;
+  if(d > s->max)
+    s->max = d;
+  s->hist[b]++;
+  popcli();
+}
+
+//* The device has no file offset, so every read returns the table
+//* from the start; kprof reads it in one call.
+static int
+kprofread(struct inode *ip, char *dst, int n)
+{
+  if(n > sizeof(kpstats))
+    n = sizeof(kpstats);
+  memmove(dst, kpstats, n);
+  return n;
+}
+
+static int
+kprofwrite(struct inode *ip, char *src, int n)
+{
+  memset(kpstats, 0, sizeof(kpstats));
+  return n;
+}
+
+//* Timer sampling. Each CPU fills its own ring from its timer
+//* interrupt and only advances head; a reader, serialized by the
+//* device inode's lock, only advances tail.
+static struct {
+  uint div;             // ticks between samples, 0: off
+  struct {
+    uint n;             // ticks since the last sample
+    uint head, tail;
+    uint dropped;       // samples lost to a full ring
+    struct ksample buf[NSAMPLE];
+  } cpu[NCPU];
+} sprof;
+
+//* Called from trap() on every timer interrupt, interrupts off.
+void
+ksample(struct trapframe *tf)
+{
+  struct proc *p;
+  struct ksample *s;
+  int c;
+
+  if(sprof.div == 0)
+    return;
+  c = cpuid();
+  if(++sprof.cpu[c].n < sprof.div)
+    return;
+  sprof.cpu[c].n = 0;
+  if(sprof.cpu[c].head - sprof.cpu[c].tail == NSAMPLE){
+    sprof.cpu[c].dropped++;
+    return;
+  }
+  s = &sprof.cpu[c].buf[sprof.cpu[c].head % NSAMPLE];
+  p = myproc();
+  s->eip = tf->eip;
+  if((tf->cs&3) == DPL_USER && p){
+    s->pid = p->pid;
+    safestrcpy(s->name, p->name, sizeof(s->name));
+  } else {
+    s->pid = 0;
+    safestrcpy(s->name, "kernel", sizeof(s->name));
+  }
+  __sync_synchronize();
+  sprof.cpu[c].head++;
+}
+
+static int
+sprofread(struct inode *ip, char *dst, int n)
+{
+  struct ksample *s;
+  int c, r;
+
+  r = 0;
+  for(c = 0; c < NCPU; c++){
+    while(sprof.cpu[c].tail != sprof.cpu[c].head &&
+          r + sizeof(*s) <= n){
+      __sync_synchronize();
+      s = &sprof.cpu[c].buf[sprof.cpu[c].tail % NSAMPLE];
+      memmove(dst + r, s, sizeof(*s));
+      r += sizeof(*s);
+      __sync_synchronize();
+      sprof.cpu[c].tail++;
+    }
+  }
+  return r;
+}
+
+//* Write an int: the new sampling divisor. Reports samples that
+//* were lost since the last write because nobody drained the ring.
+static int
+sprofwrite(struct inode *ip, char *src, int n)
+{
+  int c;
+
+  if(n != sizeof(int))
+    return -1;
+  for(c = 0; c < NCPU; c++){
+    if(sprof.cpu[c].dropped)
+      cprintf("sprof: cpu%d dropped %d samples\n", c, sprof.cpu[c].dropped);
+    sprof.cpu[c].dropped = 0;
+    sprof.cpu[c].n = 0;
+  }
+  sprof.div = *(int*)src < 0 ? 0 : *(int*)src;
+  return n;
+}
+
+void
+kprofinit(void)
+{
+  devsw[KPROF].read = kprofread;
+  devsw[KPROF].write = kprofwrite;
+  devsw[SPROF].read = sprofread;
+  devsw[SPROF].write = sprofwrite;
+}
@@ -9,12 +9,51 @@
 #include "proc.h"
 #include "spinlock.h"
 
+//* Counters by lock name. Locks are created and freed with pipes,
+//* inodes and buffers, so they are counted per name, not per lock.
+//* statlock is a bare xchg flag; a spinlock here would count itself.
+//* Interrupts are turned off by hand: kinit1() creates kmem.lock
+//* before mycpu() works, so pushcli() cannot be used yet.
+static struct lockstat lockstats[NLOCKSTAT];
+static uint statlock;
+
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *ls, *r;
+  uint eflags;
+
+  r = 0;
+  eflags = readeflags();
+  cli();
+  while(xchg(&statlock, 1) != 0)
+    ;
+  for(ls = lockstats; ls < &lockstats[NLOCKSTAT]; ls++){
+    if(ls->name == 0){
+      ls->name = name;
+      r = ls;
+      break;
+    }
+    if(ls->name == name || strncmp(ls->name, name, 16) == 0){
+      r = ls;
+      break;
+    }
+  }
+  xchg(&statlock, 0);
+  if(eflags & FL_IF)
+    sti();
+  return r;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->serving = 0;
   lk->cpu = 0;
+  lk->stat = LOCKSTAT ? lockstatfor(name) : 0;
 }
 
 // Acquire the lock.
@@ -24,13 +63,21 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, spins;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  //* Take a ticket and wait for it to be served. Only the holder
+  //* writes serving, so waiters just read their shared copy.
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  spins = 0;
+  while(*(volatile uint*)&lk->serving != ticket){
+    asm volatile("pause");
+    spins++;
+  }
+  lk->locked = 1;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +87,33 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->stat->nacquire, 1);
+    if(spins){
+      __sync_fetch_and_add(&lk->stat->ncontend, 1);
+      __sync_fetch_and_add(&lk->stat->nspin, spins);
+    }
+    lk->tstart = rdtsc();
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint held;
+
   if(!holding(lk))
     panic("release");
 
+  //* Racy against other locks of the same name; it is only a statistic.
+  if(lk->stat){
+    held = rdtsc() - lk->tstart;
+    if(held > lk->stat->maxhold)
+      lk->stat->maxhold = held;
+  }
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -63,10 +128,44 @@ release(struct spinlock *lk)
   // This code can't use a C assignment, since it might
   // not be atomic. A real OS would use C atomics here.
   asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  //* Hand the lock to the next ticket.
+  asm volatile("incl %0" : "+m" (lk->serving) : );
 
   popcli();
 }
 
+//* Print the lock counters, busiest first by spins, and optionally
+//* zero them so the next dump covers only what ran in between.
+void
+lockdump(int reset)
+{
+  struct lockstat *ls, *best;
+  char done[NLOCKSTAT];
+  int i;
+
+  memset(done, 0, sizeof(done));
+  cprintf("lock: acquire contend spin maxhold(cycles)\n");
+  for(;;){
+    best = 0;
+    for(i = 0; i < NLOCKSTAT && lockstats[i].name; i++)
+      if(!done[i] && (best == 0 || lockstats[i].nspin > best->nspin))
+        best = &lockstats[i];
+    if(best == 0)
+      break;
+    done[best - lockstats] = 1;
+    if(best->nacquire == 0)
+      continue;
+    cprintf("%s: %d %d %d %d\n", best->name, best->nacquire,
+            best->ncontend, best->nspin, best->maxhold);
+  }
+  if(reset){
+    for(ls = lockstats; ls < &lockstats[NLOCKSTAT] && ls->name; ls++){
+      ls->nacquire = ls->ncontend = ls->nspin = 0;
+      ls->maxhold = 0;
+    }
+  }
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
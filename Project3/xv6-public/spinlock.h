@@ -1,11 +1,25 @@
 // Mutual exclusion lock.
+//* A ticket lock: each acquirer takes the next ticket and waits for
+//* serving to reach it, so CPUs get the lock in arrival order.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint next;         //* next ticket to hand out
+  uint serving;      //* ticket now allowed in
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+  struct lockstat *stat;  //* contention counters (LOCKSTAT), or 0
+  uint tstart;            //* rdtsc at acquire, for hold time
 };
 
+//* Contention counters, shared by all locks with the same name.
+struct lockstat {
+  char *name;
+  uint nacquire;     //* acquisitions
+  uint ncontend;     //* acquisitions that had to wait
+  uint nspin;        //* loops spent waiting
+  uint maxhold;      //* longest hold, in TSC cycles
+};
@@ -0,0 +1,128 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "kprof.h"
+
+//* sprof [-d div] cmd [args...]: run cmd while the kernel samples the
+//* interrupted EIP every div timer ticks (default 1), then print one
+//* "count name eip" line per distinct address. Feed the output to
+//* sprof.pl on the host to resolve it against kernel.sym and the
+//* programs' .sym files.
+
+#define SPROFDEV 3      // major number of the sprof device (file.h)
+#define DEVPATH  "/dev/sprof"
+#define NENT     1024   // distinct (name, eip) pairs kept
+
+struct ent {
+  char name[16];
+  uint eip;
+  uint count;
+} ents[NENT];
+int nent, lost;
+
+struct ksample samples[64];
+
+void
+add(struct ksample *s)
+{
+  int i;
+
+  for(i = 0; i < nent; i++)
+    if(ents[i].eip == s->eip && strcmp(ents[i].name, s->name) == 0){
+      ents[i].count++;
+      return;
+    }
+  if(nent == NENT){
+    lost++;
+    return;
+  }
+  strcpy(ents[nent].name, s->name);
+  ents[nent].eip = s->eip;
+  ents[nent].count = 1;
+  nent++;
+}
+
+void
+setdiv(int fd, int div)
+{
+  if(write(fd, &div, sizeof(div)) != sizeof(div)){
+    printf(2, "sprof: cannot set divisor\n");
+    exit();
+  }
+}
+
+//* Open the device node, making it if need be. It lives in /dev so it
+//* cannot be mistaken for the sprof program in /; anything there that
+//* is not a device is left alone.
+int
+opendev(void)
+{
+  struct stat st;
+  int fd;
+
+  if((fd = open(DEVPATH, O_RDWR)) < 0){
+    mkdir("/dev");
+    mknod(DEVPATH, SPROFDEV, 0);
+    fd = open(DEVPATH, O_RDWR);
+  }
+  if(fd < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || st.type != T_DEV){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, div, n, i, a;
+
+  div = 1;
+  a = 1;
+  if(argc > 2 && strcmp(argv[1], "-d") == 0){
+    div = atoi(argv[2]);
+    a = 3;
+  }
+  if(a >= argc || div <= 0){
+    printf(2, "usage: sprof [-d div] cmd [args...]\n");
+    exit();
+  }
+  if((fd = opendev()) < 0){
+    printf(2, "sprof: cannot open %s\n", DEVPATH);
+    exit();
+  }
+
+  // Throw away samples left over from an earlier run.
+  while(read(fd, samples, sizeof(samples)) > 0)
+    ;
+  setdiv(fd, div);
+  pid = fork();
+  if(pid < 0){
+    printf(2, "sprof: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fd);
+    exec(argv[a], argv + a);
+    printf(2, "sprof: exec %s failed\n", argv[a]);
+    exit();
+  }
+  wait();
+  setdiv(fd, 0);
+
+  while((n = read(fd, samples, sizeof(samples))) > 0)
+    for(i = 0; i < n / sizeof(samples[0]); i++)
+      add(&samples[i]);
+  close(fd);
+
+  printf(1, "sprof: begin\n");
+  for(i = 0; i < nent; i++)
+    printf(1, "%d %s %x\n", ents[i].count, ents[i].name, ents[i].eip);
+  printf(1, "sprof: end\n");
+  if(lost)
+    printf(2, "sprof: %d samples not tabulated\n", lost);
+  exit();
+}
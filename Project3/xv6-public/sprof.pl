@@ -0,0 +1,61 @@
+#!/usr/bin/perl -w
+
+# Resolve the output of the sprof user program to symbols.
+# Run in the build directory, after make has left kernel.sym and
+# one <prog>.sym per user program:
+#
+#   ./sprof.pl < console.log
+#
+# Samples taken in the kernel resolve against kernel.sym, samples
+# from user mode against the .sym file of the process name.
+
+my %syms;       # sym file => sorted [addr, name] pairs
+my %hits;       # "where:symbol" => samples
+my $total = 0;
+
+sub loadsyms {
+    my ($file) = @_;
+    return $syms{$file} if exists $syms{$file};
+    my @s;
+    if(open(my $fh, "<", $file)){
+        while(<$fh>){
+            push @s, [hex($1), $2] if /^([0-9a-f]+) (\S+)$/;
+        }
+        close($fh);
+    }
+    @s = sort { $a->[0] <=> $b->[0] } @s;
+    $syms{$file} = \@s;
+    return $syms{$file};
+}
+
+sub lookup {
+    my ($s, $addr) = @_;
+    my ($lo, $hi, $best) = (0, scalar(@$s) - 1, undef);
+    while($lo <= $hi){
+        my $mid = int(($lo + $hi) / 2);
+        if($s->[$mid][0] <= $addr){
+            $best = $s->[$mid][1];
+            $lo = $mid + 1;
+        } else {
+            $hi = $mid - 1;
+        }
+    }
+    return defined($best) ? $best : sprintf("0x%x", $addr);
+}
+
+my $in = 0;
+while(<>){
+    s/\r//;
+    if(/^sprof: begin/){ $in = 1; next; }
+    if(/^sprof: end/){ $in = 0; next; }
+    next unless $in && /^(\d+) (\S+) ([0-9a-f]+)$/;
+    my ($count, $name, $eip) = ($1, $2, hex($3));
+    my $file = $name eq "kernel" ? "kernel.sym" : "$name.sym";
+    $hits{"$name:" . lookup(loadsyms($file), $eip)} += $count;
+    $total += $count;
+}
+
+die "sprof.pl: no samples\n" if $total == 0;
+foreach my $k (sort { $hits{$b} <=> $hits{$a} } keys %hits){
+    printf("%6d %5.1f%%  %s\n", $hits{$k}, 100.0 * $hits{$k} / $total, $k);
+}
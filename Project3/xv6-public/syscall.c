@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "kprof.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -28,21 +29,32 @@ fetchint(uint addr, int *ip)
 // Fetch the nul-terminated string at addr from the current process.
 // Doesn't actually copy the string - just sets *pp to point at it.
 // Returns length of string, not including nul.
+//* Outside the heap the string may be in an mmap()ed region, which is
+//* faulted in a page at a time until the nul turns up (see argptr()).
 int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
-    return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  if(addr < curproc->sz){
+    ep = (char*)curproc->sz;
+    for(s = *pp; s < ep; s++){
+      if(*s == 0)
+        return s - *pp;
+    }
+    return -1;
+  }
+  for(s = *pp; ; s = ep){
+    ep = (char*)PGROUNDUP((uint)s + 1);
+    if(mmapuva((uint)s, ep - s, 0) < 0)
+      return -1;
+    for(; s < ep; s++){
+      if(*s == 0)
+        return s - *pp;
+    }
   }
-  return -1;
 }
 
 // Fetch the nth 32-bit system call argument.
@@ -63,7 +75,11 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  //* Outside the heap, the buffer may be in an mmap()ed region.
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     mmapuva((uint)i, size, 0) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -105,6 +121,13 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_yield(void);
 extern int sys_sync(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_lockstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    		sys_fork,
@@ -130,17 +153,27 @@ static int (*syscalls[])(void) = {
 [SYS_close]   		sys_close,
 [SYS_yield]   		sys_yield,
 [SYS_sync]		sys_sync,
+[SYS_mmap]		sys_mmap,
+[SYS_munmap]		sys_munmap,
+[SYS_pread]		sys_pread,
+[SYS_pwrite]		sys_pwrite,
+[SYS_readv]		sys_readv,
+[SYS_writev]		sys_writev,
+[SYS_lockstat]		sys_lockstat,
 };
 
 void
 syscall(void)
 {
   int num;
+  uint t0;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    t0 = kprof_start();
     curproc->tf->eax = syscalls[num]();
+    kprof_end(KP_SYSCALL, t0);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
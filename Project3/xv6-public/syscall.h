@@ -22,3 +22,10 @@
 #define SYS_close  21
 #define SYS_yield 23
 #define SYS_sync 24
+#define SYS_mmap 25
+#define SYS_munmap 26
+#define SYS_pread 27
+#define SYS_pwrite 28
+#define SYS_readv 29
+#define SYS_writev 30
+#define SYS_lockstat 31
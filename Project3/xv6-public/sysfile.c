@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -66,6 +68,20 @@ sys_dup(void)
   return fd;
 }
 
+//* Check that the user buffer [va, va+n) can be used by the kernel;
+//* write is set when the kernel will store into it.
+static int
+uvacheck(uint va, int n, int write)
+{
+  struct proc *curproc = myproc();
+
+  if(n < 0)
+    return -1;
+  if(va < curproc->sz && va + n <= curproc->sz && va + n >= va)
+    return 0;
+  return mmapuva(va, n, write);
+}
+
 int
 sys_read(void)
 {
@@ -75,6 +91,11 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
     return -1;
+  //* argptr() only checks for reading. CR0_WP makes the kernel's own
+  //* stores honor read-only pages, so refuse a read-only mapping here
+  //* rather than fault on it.
+  if(uvacheck((uint)p, n, 1) < 0)
+    return -1;
   return fileread(f, p, n);
 }
 
@@ -90,6 +111,89 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+//* int pread(int fd, void *buf, int n, int off)
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(off < 0 || uvacheck((uint)p, n, 1) < 0)
+    return -1;
+  iov.iov_base = p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+//* int pwrite(int fd, void *buf, int n, int off)
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  iov.iov_base = p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+//* Copy in the iovec array of readv()/writev() and check every buffer.
+static int
+argiov(struct iovec *iov, int *pcnt, int write)
+{
+  struct iovec *uiov;
+  int i, cnt;
+
+  if(argint(2, &cnt) < 0 || cnt < 0 || cnt > MAXIOV)
+    return -1;
+  if(argptr(1, (void*)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  memmove(iov, uiov, cnt*sizeof(*uiov));
+  for(i = 0; i < cnt; i++)
+    if(uvacheck((uint)iov[i].iov_base, iov[i].iov_len, write) < 0)
+      return -1;
+  *pcnt = cnt;
+  return 0;
+}
+
+//* int readv(int fd, struct iovec *iov, int iovcnt)
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt, 1) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+//* int writev(int fd, struct iovec *iov, int iovcnt)
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt, 0) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
 int
 sys_close(void)
 {
@@ -111,20 +215,26 @@ sys_fstat(void)
 
   if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
+  if(uvacheck((uint)st, sizeof(*st), 1) < 0)  //* filestat() stores into it
+    return -1;
   return filestat(f, st);
 }
 
 //* Move to upper plave
+//* Call it before anything is logged in the transaction: it may end
+//* the transaction and begin another to let dirgrow() run.
 static struct inode*
 create(char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
+  int r;
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
   ilock(dp);
 
+again:
   if((ip = dirlookup(dp, name, 0)) != 0){
     iunlockput(dp);
     ilock(ip);
@@ -138,6 +248,21 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
+  if(dirfull(dp, name)){
+    //* dp grows in transactions of its own: end the caller's, which
+    //* has logged nothing yet, and begin a new one afterwards.
+    iunlock(dp);
+    end_op();
+    r = dirgrow(dp, name);
+    begin_op();
+    ilock(dp);
+    if(r < 0){
+      iunlockput(dp);
+      return 0;
+    }
+    goto again;
+  }
+
   if((ip = ialloc(dp->dev, type)) == 0)
     panic("create: ialloc");
 
@@ -169,8 +294,8 @@ int
 sys_link(void)
 {
   char name[DIRSIZ], *new, *old, *flag;
-  int length;
   struct inode *dp, *ip;
+  int r;
 
   if(argstr(0, &flag) < 0 || argstr(1, &old) < 0 || argstr(2, &new) < 0){
     cprintf("link: read argument failed\n");
@@ -180,7 +305,7 @@ sys_link(void)
   begin_op();
   if(flag[0] == '-' && flag[1] == 'h'){
     //* Standard scheme: Hard link - share I-node
-    if((ip = namei(old)) == 0){ //* namei: get inode for current old path.
+    if((ip = nameinf(old)) == 0){ //* nameinf: get inode for current old path, not following a symlink.
       end_op();
       return -1;
     }
@@ -191,15 +316,32 @@ sys_link(void)
       end_op();
       return -1;
     }
+    iunlock(ip);
+
+    if((dp = nameiparent(new, name)) == 0){ //* nameiparent: get inode of the parent, and copy.
+      iput(ip);
+      end_op();
+      return -1;
+    }
+    //* Make room in dp before logging anything; dirgrow() needs
+    //* transactions of its own.
+    ilock(dp);
+    while(dp->dev == ip->dev && dirfull(dp, name)){
+      iunlock(dp);
+      end_op();
+      r = dirgrow(dp, name);
+      begin_op();
+      ilock(dp);
+      if(r < 0)
+        break;
+    }
 
+    ilock(ip);
     ip->nlink++; //* Increase inode's linked number.
     iupdate(ip); //* iupdate() copy a modified in-memory inode to disk 
   	         //- called after every changes of ip->xxx
     iunlock(ip);
 
-    if((dp = nameiparent(new, name)) == 0) //* nameiparent: get inode of the parent, and copy.
-      goto bad;
-    ilock(dp);
     if(dp->dev != ip->dev || dirlink(dp, name, ip->inum) < 0){
       iunlockput(dp);
       goto bad;
@@ -223,7 +365,8 @@ sys_link(void)
     //* old: will be path for current symbolic link.
     
     //* Step 2) Save path information in current inode.
-    //* Required info: path length, path string
+    //* Short paths are kept in the inode itself (see symwrite()),
+    //* longer ones in its data as:
     /*
       --------
      |  path  |
@@ -234,16 +377,12 @@ sys_link(void)
       --------
      */
     //* later used to refer current path and namei() it.
-    length = strlen(old);
-    //* Lock
-    //ilock(ip);
-
-    //* Write path length and path info
-    writei(ip, (char*)&length, 0, sizeof(int));
-    writei(ip, old, sizeof(int), length + 1); //* Save length information. +1 for null character '\0'
+    if(symwrite(ip, old) < 0){
+      iunlockput(ip);
+      end_op();
+      return -1;
+    }
 
-    //* Unlock
-    iupdate(ip);
     iunlockput(ip);
   }
   end_op();
@@ -313,6 +452,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_drop(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -333,51 +473,11 @@ bad:
   return -1;
 }
 
-//* Modify Open - symbolic link
-struct inode*
-followip(struct inode* ip, char* path){
-  int length;
-  // * Check if current inode is symbolic link
-  // * if symbolic link, go to directing link and return it.
-  
-  //ilock(ip);
-
-  if(ip->type == T_SBLK) {
-    // * Current inode is symbolic link
-    // * read path length, path information in inode.
-    // * based on path information, reach inode until inode is non-symbolic link
-    do {
-      // * read first info: path length
-      readi(ip, (char*)&length, 0, sizeof(int));
-
-      // * read path info based on length info
-      // * update path info
-      readi(ip, path, sizeof(int), length + 1);
-      iunlockput(ip);
-
-      // * get inode for current path, then update ip.
-      if((ip = namei(path)) == 0){
-        // * Error: cannot find current inode
-        // * Original inode could be deleted.
-        cprintf("Error: Inode cannot found. Original file could be deleted or possible inode corruption occured.\n");
-        //end_op();
-        return 0;
-      }
-      ilock(ip); // * Lock again; readi.
-      // * If newly updated ip is symbolic link,
-      // * loop again until non-symbolic found. 
-    } while(ip->type == T_SBLK);
-  }
-
-  return ip;
-}
-
-
 int
 sys_open(void)
 {
   char *path;
-  int fd, omode, length;
+  int fd, omode;
   struct file *f;
   struct inode *ip;
 
@@ -393,7 +493,12 @@ sys_open(void)
       return -1;
     }
   } else {
-    if((ip = namei(path)) == 0){
+    //* namei() follows symbolic links; O_NFSBLK opens the link itself.
+    if(omode & O_NFSBLK)
+      ip = nameinf(path);
+    else
+      ip = namei(path);
+    if(ip == 0){
       end_op();
       return -1;
     }
@@ -403,33 +508,6 @@ sys_open(void)
       end_op();
       return -1;
     }
-    if(ip->type == T_SBLK && (omode != O_NFSBLK)) { //* will not follow if this omode is O_NFSBLK (not follow symbolic link).
-      // * Current inode is symbolic link
-      // * read path length, path information in inode.
-      // * based on path information, reach inode until inode is non-symbolic link.
-      
-      do {
-        // * read first info: path length
-        readi(ip, (char*)&length, 0, sizeof(int));
-
-        // * read path info based on length info
-        // * update path info
-        readi(ip, path, sizeof(int), length + 1);
-        iunlockput(ip);
-
-        // * get inode for current path, then update ip.
-        if((ip = namei(path)) == 0){
-          // * Error: cannot find current inode
-          // * Original inode could be deleted.
-          cprintf("Error: Inode cannot found. Original file could be deleted or possible inode corruption occured.\n");
-          end_op();
-          return -1;
-        }
-	ilock(ip); // * Lock again; readi.
-        // * If newly updated ip is symbolic link,
-        // * loop again until non-symbolic found.
-      } while(ip->type == T_SBLK);
-    }
   }
 
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
@@ -544,7 +622,8 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 ||
+     uvacheck((uint)fd, 2*sizeof(fd[0]), 1) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -560,3 +639,36 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+//* void *mmap(void *addr, int length, int prot, int flags, int fd, int offset)
+//* addr is only a hint and is ignored; offset must be page aligned.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
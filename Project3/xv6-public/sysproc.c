@@ -89,3 +89,16 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+//* Dump the kernel lock counters to the console; a non-zero
+//* argument also resets them.
+int
+sys_lockstat(void)
+{
+  int reset;
+
+  if(argint(0, &reset) < 0)
+    return -1;
+  lockdump(reset);
+  return 0;
+}
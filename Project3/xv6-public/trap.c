@@ -7,6 +7,7 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "kprof.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -37,6 +38,8 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  uint t0;
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -59,6 +62,7 @@ trap(struct trapframe *tf)
     return;
   }
 
+  t0 = kprof_start();
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
@@ -67,6 +71,7 @@ trap(struct trapframe *tf)
       wakeup(&ticks);
       release(&tickslock);
     }
+    ksample(tf);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -91,6 +96,14 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  //* A user page fault in an mmap()ed region brings the page in;
+  //* anything else is handled as before.
+  case T_PGFLT:
+    if(myproc() && (tf->cs&3) == DPL_USER &&
+       mmapfault(myproc(), rcr2(), tf->err & 2) == 0)  // bit 1: write
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -106,6 +119,7 @@ trap(struct trapframe *tf)
             tf->err, cpuid(), tf->eip, rcr2());
     myproc()->killed = 1;
   }
+  kprof_end(KP_TRAP, t0);
 
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
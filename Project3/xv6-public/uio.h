@@ -0,0 +1,5 @@
+//* One buffer of a readv()/writev() scatter/gather list
+struct iovec {
+  void *iov_base;
+  uint iov_len;
+};
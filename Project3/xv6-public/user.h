@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -25,6 +26,13 @@ int sleep(int);
 int uptime(void);
 void yield(void);
 int sync(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int lockstat(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -32,7 +32,7 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
@@ -57,7 +57,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -114,6 +114,40 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+//* Like mappages() for the kernel part of a page table, but a whole,
+//* aligned 4 MB of the range is one PTE_PS superpage in the page
+//* directory: no page-table page to allocate, one TLB entry. The
+//* direct map up to PHYSTOP then costs a process a handful of page
+//* table pages instead of one per 4 MB. (Needs CR4_PSE; entry.S and
+//* entryother.S set it.)
+static int
+mapkvm(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  char *a, *last;
+  uint step;
+
+  a = (char*)PGROUNDDOWN((uint)va);
+  last = (char*)PGROUNDDOWN(((uint)va) + size - 1);
+  for(;;){
+    if(KSUPERPAGE && (uint)a % SPGSIZE == 0 && pa % SPGSIZE == 0 &&
+       (uint)(last - a) >= SPGSIZE - PGSIZE){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS;
+      step = SPGSIZE;
+    } else {
+      if(mappages(pgdir, a, PGSIZE, pa, perm) < 0)
+        return -1;
+      step = PGSIZE;
+    }
+    if((uint)(last - a) < step)
+      break;
+    a += step;
+    pa += step;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
@@ -127,8 +161,8 @@ setupkvm(void)
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkvm(pgdir, k->virt, k->phys_end - k->phys_start,
+              (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -289,7 +323,7 @@ freevm(pde_t *pgdir)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){  //* superpages own no table
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -130,6 +130,16 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+//* Low 32 bits of the time-stamp counter.
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
 static inline uint
 rcr2(void)
 {